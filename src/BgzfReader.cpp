@@ -0,0 +1,229 @@
+#include "BgzfReader.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+#ifdef METAM_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define BGZF_HEADER_LENGTH 12
+#define BGZF_FOOTER_LENGTH 8
+#define BGZF_MAX_BLOCK_DATA 65536
+
+static inline unsigned int LittleEndian16(const unsigned char *Bytes)
+{
+    return Bytes[0] | (Bytes[1] << 8);
+}
+
+static inline unsigned int LittleEndian32(const unsigned char *Bytes)
+{
+    return Bytes[0] | (Bytes[1] << 8) | (Bytes[2] << 16) | ((unsigned int)Bytes[3] << 24);
+}
+
+// A gzip member header with an extra field, as every BGZF block starts with
+static inline bool IsGzipHeader(const unsigned char *Header)
+{
+    return Header[0]==31 && Header[1]==139 && Header[2]==8 && (Header[3] & 4);
+}
+
+BgzfReader::BgzfReader()
+{
+    File = NULL;
+    NoThreads = 1;
+    NoBlocks = CurrentBlock = 0;
+    CurrentOffset = 0;
+    for(int i=0; i<BGZF_THREADS; i++)
+        Decompressors[i] = NULL;
+}
+
+BgzfReader::~BgzfReader()
+{
+    Close();
+    for(int i=0; i<BGZF_THREADS; i++)
+    {
+        if(Decompressors[i] == NULL)
+            continue;
+#ifdef METAM_LIBDEFLATE
+        libdeflate_free_decompressor(Decompressors[i]);
+#else
+        inflateEnd(Decompressors[i]);
+        delete Decompressors[i];
+#endif
+    }
+}
+
+bool BgzfReader::Open(const char *FileName, int NoThreads)
+{
+    Close();
+    File = fopen(FileName, "rb");
+    if(File == NULL)
+        return false;
+
+    // BGZF files start with a block whose extra field is the BC subfield
+    unsigned char Header[BGZF_HEADER_LENGTH+6];
+    if(fread(Header, 1, sizeof(Header), File) != sizeof(Header) || !IsGzipHeader(Header)
+       || Header[12]!='B' || Header[13]!='C' || LittleEndian16(Header+14)!=2)
+    {
+        Close();
+        return false;
+    }
+    rewind(File);
+
+    this->FileName = FileName;
+    this->NoThreads = max(1, min(BGZF_THREADS, NoThreads));
+    NoBlocks = CurrentBlock = 0;
+    CurrentOffset = 0;
+    return true;
+}
+
+void BgzfReader::Close()
+{
+    if(File != NULL)
+        fclose(File);
+    File = NULL;
+}
+
+bool BgzfReader::ReadBlock(Block &ThisBlock)
+{
+    vector<unsigned char> &Bytes = ThisBlock.Compressed;
+    Bytes.resize(BGZF_HEADER_LENGTH);
+    size_t NoRead = fread(&Bytes[0], 1, BGZF_HEADER_LENGTH, File);
+    if(NoRead == 0)
+        return false;
+
+    int BlockSize = 0;
+    if(NoRead == BGZF_HEADER_LENGTH && IsGzipHeader(&Bytes[0]))
+    {
+        int ExtraLength = LittleEndian16(&Bytes[10]);
+        Bytes.resize(BGZF_HEADER_LENGTH+ExtraLength);
+        if(fread(&Bytes[BGZF_HEADER_LENGTH], 1, ExtraLength, File) == (size_t)ExtraLength)
+        {
+            // Subfields are SI1 SI2 SLEN and SLEN bytes of data
+            for(int i=BGZF_HEADER_LENGTH; i+4<=BGZF_HEADER_LENGTH+ExtraLength; i+=4+LittleEndian16(&Bytes[i+2]))
+                if(Bytes[i]=='B' && Bytes[i+1]=='C' && LittleEndian16(&Bytes[i+2])==2 && i+6<=BGZF_HEADER_LENGTH+ExtraLength)
+                    BlockSize = LittleEndian16(&Bytes[i+4]) + 1;
+        }
+    }
+
+    int Remaining = BlockSize - (int)Bytes.size();
+    if(Remaining < BGZF_FOOTER_LENGTH)
+    {
+        cout << "\n ERROR !!! \n Corrupted BGZF block in file : " << FileName << endl;
+        abort();
+    }
+    Bytes.resize(BlockSize);
+    if(fread(&Bytes[BlockSize-Remaining], 1, Remaining, File) != (size_t)Remaining)
+    {
+        cout << "\n ERROR !!! \n Truncated BGZF block in file : " << FileName << endl;
+        abort();
+    }
+    return true;
+}
+
+void BgzfReader::InflateBlock(Block &ThisBlock, int Thread)
+{
+    const unsigned char *Bytes = &ThisBlock.Compressed[0];
+    size_t Start = BGZF_HEADER_LENGTH + LittleEndian16(Bytes+10);
+    size_t End = ThisBlock.Compressed.size() - BGZF_FOOTER_LENGTH;
+    unsigned int Crc = LittleEndian32(Bytes+End);
+    unsigned int Size = LittleEndian32(Bytes+End+4);
+
+    ThisBlock.Valid = false;
+    if(Size > BGZF_MAX_BLOCK_DATA || End < Start)
+        return;
+    ThisBlock.Data.resize(Size);
+    char Empty;
+    char *Data = Size > 0 ? &ThisBlock.Data[0] : &Empty;
+
+#ifdef METAM_LIBDEFLATE
+    if(Decompressors[Thread] == NULL)
+        Decompressors[Thread] = libdeflate_alloc_decompressor();
+    if(Decompressors[Thread] == NULL)
+        return;
+    size_t NoInflated;
+    enum libdeflate_result Status = libdeflate_deflate_decompress(Decompressors[Thread], Bytes+Start, End-Start, Data, Size, &NoInflated);
+    if(Status != LIBDEFLATE_SUCCESS || NoInflated != Size)
+        return;
+    ThisBlock.Valid = libdeflate_crc32(0, Data, Size) == Crc;
+#else
+    if(Decompressors[Thread] == NULL)
+    {
+        z_stream *Stream = new z_stream;
+        memset(Stream, 0, sizeof(z_stream));
+        if(inflateInit2(Stream, -15) != Z_OK)
+        {
+            delete Stream;
+            return;
+        }
+        Decompressors[Thread] = Stream;
+    }
+    z_stream &Stream = *Decompressors[Thread];
+    if(inflateReset(&Stream) != Z_OK)
+        return;
+    Stream.next_in = (Bytef*)(Bytes+Start);
+    Stream.avail_in = End-Start;
+    Stream.next_out = (Bytef*)Data;
+    Stream.avail_out = Size;
+    int Status = inflate(&Stream, Z_FINISH);
+    if(Status != Z_STREAM_END || Stream.total_out != Size)
+        return;
+    ThisBlock.Valid = crc32(0L, (const Bytef*)Data, Size) == Crc;
+#endif
+}
+
+bool BgzfReader::ReadBatch()
+{
+    NoBlocks = 0;
+    while(NoBlocks < BGZF_BATCH_BLOCKS && ReadBlock(Blocks[NoBlocks]))
+        NoBlocks++;
+
+    #pragma omp parallel num_threads(NoThreads) if(NoBlocks > 1)
+    {
+        int Thread = 0;
+#ifdef _OPENMP
+        Thread = omp_get_thread_num();
+#endif
+        #pragma omp for schedule(dynamic)
+        for(int i=0; i<NoBlocks; i++)
+            InflateBlock(Blocks[i], Thread);
+    }
+
+    for(int i=0; i<NoBlocks; i++)
+        if(!Blocks[i].Valid)
+        {
+            cout << "\n ERROR !!! \n Corrupted BGZF block in file : " << FileName << endl;
+            abort();
+        }
+
+    CurrentBlock = 0;
+    CurrentOffset = 0;
+    return NoBlocks > 0;
+}
+
+unsigned int BgzfReader::Read(char *Out, unsigned int Size)
+{
+    unsigned int NoCopied = 0;
+    while(NoCopied < Size)
+    {
+        if(CurrentBlock == NoBlocks && !ReadBatch())
+            break;
+
+        Block &ThisBlock = Blocks[CurrentBlock];
+        size_t NoCopy = min((size_t)(Size-NoCopied), ThisBlock.Data.size()-CurrentOffset);
+        if(NoCopy > 0)
+            memcpy(Out+NoCopied, &ThisBlock.Data[CurrentOffset], NoCopy);
+        NoCopied += NoCopy;
+        CurrentOffset += NoCopy;
+        if(CurrentOffset == ThisBlock.Data.size())
+        {
+            CurrentBlock++;
+            CurrentOffset = 0;
+        }
+    }
+    return NoCopied;
+}
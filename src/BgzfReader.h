@@ -0,0 +1,73 @@
+#ifndef METAM_BGZFREADER_H
+#define METAM_BGZFREADER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct libdeflate_decompressor;
+struct z_stream_s;
+
+// Sequential reader of a BGZF file (as written by bgzip and by Minimac4)
+// that inflates its blocks in parallel.
+//
+// BGZF blocks are independent gzip members of at most 64KB of data, and
+// each one records its own compressed size. The reader reads the next
+// BGZF_BATCH_BLOCKS blocks as they are, inflates them on up to
+// BGZF_THREADS of the threads given to Open, and hands out their data in
+// file order before reading the next batch. Inflating does not overlap
+// parsing: the caller waits for each batch, which is at most 4MB of data.
+// Blocks are inflated with libdeflate when the build finds it, and with
+// zlib otherwise, using one decompressor per thread for the life of the
+// reader.
+
+#define BGZF_BATCH_BLOCKS 64
+#define BGZF_THREADS 4
+
+class BgzfReader
+{
+public:
+
+    BgzfReader();
+    ~BgzfReader();
+
+    // Opens FileName if it is BGZF compressed, and returns false otherwise.
+    // Blocks are inflated on up to NoThreads OpenMP threads.
+    bool Open(const char *FileName, int NoThreads);
+    void Close();
+    bool IsOpen() { return File != NULL; }
+
+    // Copies up to Size bytes of data to Out, and returns the number of
+    // bytes copied, which is 0 only at the end of the file.
+    unsigned int Read(char *Out, unsigned int Size);
+
+private:
+
+    struct Block
+    {
+        vector<unsigned char> Compressed;
+        vector<char> Data;
+        bool Valid;
+    };
+
+    FILE *File;
+    string FileName;
+    int NoThreads;
+    Block Blocks[BGZF_BATCH_BLOCKS];
+    int NoBlocks, CurrentBlock;
+    size_t CurrentOffset;
+
+#ifdef METAM_LIBDEFLATE
+    libdeflate_decompressor *Decompressors[BGZF_THREADS];
+#else
+    z_stream_s *Decompressors[BGZF_THREADS];
+#endif
+
+    bool ReadBlock(Block &ThisBlock);
+    bool ReadBatch();
+    void InflateBlock(Block &ThisBlock, int Thread);
+};
+
+#endif //METAM_BGZFREADER_H
@@ -0,0 +1,246 @@
+#include "CompactWeights.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define METAM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+// Weights lie in [0,1], so half precision drops the sign bit of the usual
+// format and spends it on the exponent: a 6-bit exponent biased by 63 and a
+// 10-bit mantissa, i.e. the upper bits of the float with its exponent
+// rebased. Weights below 2^-62 are clamped to the smallest normal value so
+// that no weight becomes exactly zero.
+#define HALF_MIN_BITS (65u << 23)
+#define HALF_REBASE (64u << 23)
+
+static inline unsigned short NarrowHalfOne(double Value)
+{
+    float Single = (float)Value;
+    unsigned int Bits;
+    memcpy(&Bits, &Single, sizeof(Bits));
+    if(Bits < HALF_MIN_BITS)
+        Bits = HALF_MIN_BITS;
+    Bits -= HALF_REBASE;
+    Bits += 0xfff + ((Bits >> 13) & 1);
+    return (unsigned short)(Bits >> 13);
+}
+
+static inline double WidenHalfOne(unsigned short Half)
+{
+    unsigned int Bits = ((unsigned int)Half << 13) + HALF_REBASE;
+    float Single;
+    memcpy(&Single, &Bits, sizeof(Single));
+    return Single;
+}
+
+
+static void NarrowFloatScalar(const double *From, void *To, int Length)
+{
+    float *Out = (float*)To;
+    for(int h=0; h<Length; h++)
+        Out[h] = (float)From[h];
+}
+
+static void WidenFloatScalar(const void *From, double *To, int Length)
+{
+    const float *In = (const float*)From;
+    for(int h=0; h<Length; h++)
+        To[h] = In[h];
+}
+
+static void NarrowHalfScalar(const double *From, void *To, int Length)
+{
+    unsigned short *Out = (unsigned short*)To;
+    for(int h=0; h<Length; h++)
+        Out[h] = NarrowHalfOne(From[h]);
+}
+
+static void WidenHalfScalar(const void *From, double *To, int Length)
+{
+    const unsigned short *In = (const unsigned short*)From;
+    for(int h=0; h<Length; h++)
+        To[h] = WidenHalfOne(In[h]);
+}
+
+
+#ifdef METAM_X86_KERNELS
+
+__attribute__((target("avx2")))
+static void NarrowFloatAVX2(const double *From, void *To, int Length)
+{
+    float *Out = (float*)To;
+    int h = 0;
+    for(; h+4<=Length; h+=4)
+        _mm_storeu_ps(Out+h, _mm256_cvtpd_ps(_mm256_loadu_pd(From+h)));
+    for(; h<Length; h++)
+        Out[h] = (float)From[h];
+}
+
+__attribute__((target("avx2")))
+static void WidenFloatAVX2(const void *From, double *To, int Length)
+{
+    const float *In = (const float*)From;
+    int h = 0;
+    for(; h+4<=Length; h+=4)
+        _mm256_storeu_pd(To+h, _mm256_cvtps_pd(_mm_loadu_ps(In+h)));
+    for(; h<Length; h++)
+        To[h] = In[h];
+}
+
+__attribute__((target("avx2")))
+static void NarrowHalfAVX2(const double *From, void *To, int Length)
+{
+    unsigned short *Out = (unsigned short*)To;
+    const __m128i Minimum = _mm_set1_epi32(HALF_MIN_BITS);
+    const __m128i Rebase = _mm_set1_epi32(HALF_REBASE);
+    const __m128i Round = _mm_set1_epi32(0xfff);
+    const __m128i One = _mm_set1_epi32(1);
+    int h = 0;
+    for(; h+4<=Length; h+=4)
+    {
+        __m128i Bits = _mm_castps_si128(_mm256_cvtpd_ps(_mm256_loadu_pd(From+h)));
+        Bits = _mm_sub_epi32(_mm_max_epi32(Bits, Minimum), Rebase);
+        Bits = _mm_add_epi32(Bits, _mm_add_epi32(Round, _mm_and_si128(_mm_srli_epi32(Bits, 13), One)));
+        Bits = _mm_srli_epi32(Bits, 13);
+        _mm_storel_epi64((__m128i*)(Out+h), _mm_packus_epi32(Bits, Bits));
+    }
+    for(; h<Length; h++)
+        Out[h] = NarrowHalfOne(From[h]);
+}
+
+__attribute__((target("avx2")))
+static void WidenHalfAVX2(const void *From, double *To, int Length)
+{
+    const unsigned short *In = (const unsigned short*)From;
+    const __m128i Rebase = _mm_set1_epi32(HALF_REBASE);
+    int h = 0;
+    for(; h+4<=Length; h+=4)
+    {
+        __m128i Bits = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(In+h)));
+        Bits = _mm_add_epi32(_mm_slli_epi32(Bits, 13), Rebase);
+        _mm256_storeu_pd(To+h, _mm256_cvtps_pd(_mm_castsi128_ps(Bits)));
+    }
+    for(; h<Length; h++)
+        To[h] = WidenHalfOne(In[h]);
+}
+
+#endif
+
+
+CompactWeights::CompactWeights()
+{
+    Precision = DOUBLE_WEIGHTS;
+    Name = "double";
+    NoStudies = NoHaps = 0;
+    ElementSize = sizeof(double);
+    Narrow = NULL;
+    Widen = NULL;
+}
+
+void CompactWeights::Initialize(WeightPrecision precision)
+{
+    Precision = precision;
+    switch(Precision)
+    {
+        case DOUBLE_WEIGHTS:
+            Name = "double";
+            ElementSize = sizeof(double);
+            Narrow = NULL;
+            Widen = NULL;
+            break;
+        case FLOAT_WEIGHTS:
+            Name = "float";
+            ElementSize = sizeof(float);
+            Narrow = NarrowFloatScalar;
+            Widen = WidenFloatScalar;
+            break;
+        case HALF_WEIGHTS:
+            Name = "half";
+            ElementSize = sizeof(unsigned short);
+            Narrow = NarrowHalfScalar;
+            Widen = WidenHalfScalar;
+            break;
+    }
+
+#ifdef METAM_X86_KERNELS
+    __builtin_cpu_init();
+    if(Precision == FLOAT_WEIGHTS && __builtin_cpu_supports("avx2"))
+    {
+        Narrow = NarrowFloatAVX2;
+        Widen = WidenFloatAVX2;
+    }
+    else if(Precision == HALF_WEIGHTS && __builtin_cpu_supports("avx2"))
+    {
+        Narrow = NarrowHalfAVX2;
+        Widen = WidenHalfAVX2;
+    }
+#endif
+}
+
+void CompactWeights::Resize(int sites, int studies, int haps)
+{
+    NoStudies = studies;
+    NoHaps = haps;
+    if(Precision == FLOAT_WEIGHTS)
+        FloatData.Resize(sites, studies-1, haps);
+    else if(Precision == HALF_WEIGHTS)
+        HalfData.Resize(sites, studies-1, haps);
+    Dropped.Resize(sites, 1, haps);
+}
+
+char* CompactWeights::Row(int site, int study)
+{
+    if(Precision == FLOAT_WEIGHTS)
+        return (char*)FloatData.Row(site, study);
+    return (char*)HalfData.Row(site, study);
+}
+
+void CompactWeights::Store(int site, const double *Weights, int Stride, int HapStart, int HapEnd)
+{
+    int Last = NoStudies-1;
+    for(int i=0; i<Last; i++)
+        Narrow(Weights + i*Stride + HapStart, Row(site, i) + HapStart*ElementSize, HapEnd-HapStart);
+
+    unsigned char *ThisDropped = Dropped.Site(site);
+    for(int h=HapStart; h<HapEnd; h++)
+    {
+        int Largest = Last;
+        for(int i=0; i<Last; i++)
+            if(Weights[i*Stride+h] > Weights[Largest*Stride+h])
+                Largest = i;
+
+        ThisDropped[h] = Largest;
+        if(Largest != Last)
+            Narrow(Weights + Last*Stride + h, Row(site, Largest) + h*ElementSize, 1);
+    }
+}
+
+void CompactWeights::Load(int site, double *Weights, int Stride)
+{
+    int Last = NoStudies-1;
+    double *LastWeights = Weights + Last*Stride;
+    for(int h=0; h<NoHaps; h++)
+        LastWeights[h] = 1.0;
+
+    for(int i=0; i<Last; i++)
+    {
+        double *ThisWeights = Weights + i*Stride;
+        Widen(Row(site, i), ThisWeights, NoHaps);
+        for(int h=0; h<NoHaps; h++)
+            LastWeights[h] -= ThisWeights[h];
+    }
+
+    // Put the restored largest weight back in its own row.
+    const unsigned char *ThisDropped = Dropped.Site(site);
+    for(int h=0; h<NoHaps; h++)
+    {
+        int Largest = ThisDropped[h];
+        if(Largest != Last)
+        {
+            double Restored = LastWeights[h];
+            LastWeights[h] = Weights[Largest*Stride+h];
+            Weights[Largest*Stride+h] = Restored;
+        }
+    }
+}
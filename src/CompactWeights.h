@@ -0,0 +1,62 @@
+#ifndef METAM_COMPACTWEIGHTS_H
+#define METAM_COMPACTWEIGHTS_H
+
+#include "WeightTensor.h"
+
+// Posterior weights of a batch kept in reduced precision for the
+// interpolation pass. The weights of a haplotype sum to one, so only
+// NoStudies-1 of them are stored and the remaining one is restored as one
+// minus their sum when the site is widened back to doubles. The dropped
+// weight is the largest of the haplotype, which keeps the relative error
+// of every weight small and so survives renormalizing over proper subsets
+// of the studies. The largest weight is dropped from its own row and the
+// last study's weight is stored there instead.
+//
+//      float : single precision, relative error below 6e-8
+//      half  : unsigned 16-bit float, relative error below 5e-4
+
+enum WeightPrecision
+{
+    DOUBLE_WEIGHTS,
+    FLOAT_WEIGHTS,
+    HALF_WEIGHTS
+};
+
+typedef void (*NarrowKernel)(const double *From, void *To, int Length);
+typedef void (*WidenKernel)(const void *From, double *To, int Length);
+
+class CompactWeights
+{
+public:
+
+    WeightPrecision Precision;
+    const char *Name;
+
+    CompactWeights();
+
+    // Picks the conversion kernels using the widest instruction set
+    // supported by the running CPU.
+    void Initialize(WeightPrecision precision);
+    void Resize(int sites, int studies, int haps);
+
+    // Stores haplotypes [HapStart,HapEnd) of one site, read from NoStudies
+    // rows of double weights that are Stride apart.
+    void Store(int site, const double *Weights, int Stride, int HapStart, int HapEnd);
+
+    // Widens all haplotypes of one site back into NoStudies rows of doubles.
+    void Load(int site, double *Weights, int Stride);
+
+private:
+
+    int NoStudies, NoHaps;
+    size_t ElementSize;
+    AlignedTensor<float> FloatData;
+    AlignedTensor<unsigned short> HalfData;
+    AlignedTensor<unsigned char> Dropped;
+    NarrowKernel Narrow;
+    WidenKernel Widen;
+
+    char* Row(int site, int study);
+};
+
+#endif //METAM_COMPACTWEIGHTS_H
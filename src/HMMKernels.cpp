@@ -0,0 +1,475 @@
+#include "HMMKernels.h"
+#include <cstdlib>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define METAM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+template<int K>
+static inline void EmissionOne(const HMMSiteData &Site, int h, const HMMStepParameters &Param, double *Emission)
+{
+    int gt = (Site.GT[h>>3] >> (h&7)) & 1;
+    for(int k=0; k<K; k++)
+        Emission[k] = Param.Offset[gt] + Param.Slope[gt]*Site.Dosage[k][h];
+}
+
+template<int K>
+static inline void LeftStepOne(const double *Prev, double *Curr, const HMMSiteData &Site,
+                               int Stride, int h, const HMMStepParameters &Param)
+{
+    double Emission[K];
+    EmissionOne<K>(Site, h, Param, Emission);
+
+    double Left[K];
+    double sum = 0.0;
+    for(int k=0; k<K; k++)
+    {
+        Left[k] = (Param.r + Param.complement*Prev[k*Stride+h]) * Emission[k];
+        sum += Left[k];
+    }
+
+    double scale = 1.0/sum;
+    for(int k=0; k<K; k++)
+        Curr[k*Stride+h] = Left[k]*scale;
+}
+
+template<int K>
+static inline void RightStepOne(double *PrevRight, double *Weight, const HMMSiteData &Site,
+                                int Stride, int h, const HMMStepParameters &Param)
+{
+    double Emission[K];
+    EmissionOne<K>(Site, h, Param, Emission);
+
+    double Prev[K];
+    double sum = 0.0;
+    for(int k=0; k<K; k++)
+    {
+        Prev[k] = PrevRight[k*Stride+h] * Emission[k];
+        sum += Prev[k];
+    }
+
+    double scale = 1.0/sum;
+    double Posterior[K];
+    double PosteriorSum = 0.0;
+    for(int k=0; k<K; k++)
+    {
+        double Right = Param.r + Param.complement*Prev[k]*scale;
+        PrevRight[k*Stride+h] = Right;
+        Posterior[k] = Weight[k*Stride+h]*Right;
+        PosteriorSum += Posterior[k];
+    }
+
+    double PosteriorScale = 1.0/PosteriorSum;
+    for(int k=0; k<K; k++)
+        Weight[k*Stride+h] = Posterior[k]*PosteriorScale;
+}
+
+
+template<int K>
+static void LeftStepScalar(const double *Prev, double *Curr, const HMMSiteData &Site,
+                           int Stride, int Length, const HMMStepParameters &Param)
+{
+    for(int h=0; h<Length; h++)
+        LeftStepOne<K>(Prev, Curr, Site, Stride, h, Param);
+}
+
+template<int K>
+static void RightStepScalar(double *PrevRight, double *Weight, const HMMSiteData &Site,
+                            int Stride, int Length, const HMMStepParameters &Param)
+{
+    for(int h=0; h<Length; h++)
+        RightStepOne<K>(PrevRight, Weight, Site, Stride, h, Param);
+}
+
+template<int K, bool Renormalize>
+static inline double InterpolateOne(const HMMInterpolationData &Data, int h)
+{
+    double Dosage = 0.0;
+    for(int k=0; k<K; k++)
+        Dosage += (Data.Prev[k][h] + Data.t*Data.Slope[k][h]) * Data.Dosage[k][h];
+    if(Renormalize)
+        Dosage /= Data.PrevSum[h] + Data.t*Data.SlopeSum[h];
+    return Dosage;
+}
+
+template<int K, bool Renormalize>
+static void InterpolateScalar(const HMMInterpolationData &Data, float *Out, int Length,
+                              double &Sum, double &SumSq)
+{
+    for(int h=0; h<Length; h++)
+    {
+        double Dosage = InterpolateOne<K,Renormalize>(Data, h);
+        Out[h] = Dosage;
+        Sum += Dosage;
+        SumSq += Dosage*Dosage;
+    }
+}
+
+template<int K, bool Renormalize>
+static void InterpolateAtScalar(const HMMInterpolationData &Data, const int *Haps, int NoHaps,
+                                float *Out, double &Sum, double &SumSq)
+{
+    for(int i=0; i<NoHaps; i++)
+    {
+        double Dosage = InterpolateOne<K,Renormalize>(Data, Haps[i]);
+        Out[Haps[i]] = Dosage;
+        Sum += Dosage;
+        SumSq += Dosage*Dosage;
+    }
+}
+
+
+#ifdef METAM_X86_KERNELS
+
+// Emissions of 4 haplotypes starting at h, a multiple of 4.
+template<int K>
+__attribute__((target("avx2")))
+static inline void EmissionAVX2(const HMMSiteData &Site, int h, const HMMStepParameters &Param, __m256d *Emission)
+{
+    const __m256i Bits = _mm256_set_epi64x(8, 4, 2, 1);
+    __m256i Nibble = _mm256_set1_epi64x((Site.GT[h>>3] >> (h&4)) & 0xF);
+    __m256d Alt = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(Nibble, Bits), Bits));
+    __m256d Offset = _mm256_blendv_pd(_mm256_set1_pd(Param.Offset[0]), _mm256_set1_pd(Param.Offset[1]), Alt);
+    __m256d Slope = _mm256_blendv_pd(_mm256_set1_pd(Param.Slope[0]), _mm256_set1_pd(Param.Slope[1]), Alt);
+
+    for(int k=0; k<K; k++)
+    {
+        __m256d Dosage = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(Site.Dosage[k]+h))));
+        Emission[k] = _mm256_add_pd(Offset, _mm256_mul_pd(Slope, Dosage));
+    }
+}
+
+template<int K>
+__attribute__((target("avx2")))
+static void LeftStepAVX2(const double *Prev, double *Curr, const HMMSiteData &Site,
+                         int Stride, int Length, const HMMStepParameters &Param)
+{
+    const __m256d r = _mm256_set1_pd(Param.r);
+    const __m256d complement = _mm256_set1_pd(Param.complement);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    int h = 0;
+    for(; h+4<=Length; h+=4)
+    {
+        __m256d Emission[K];
+        EmissionAVX2<K>(Site, h, Param, Emission);
+
+        __m256d Left[K];
+        __m256d sum = _mm256_setzero_pd();
+        for(int k=0; k<K; k++)
+        {
+            Left[k] = _mm256_add_pd(r, _mm256_mul_pd(complement, _mm256_loadu_pd(Prev+k*Stride+h)));
+            Left[k] = _mm256_mul_pd(Left[k], Emission[k]);
+            sum = _mm256_add_pd(sum, Left[k]);
+        }
+
+        __m256d scale = _mm256_div_pd(one, sum);
+        for(int k=0; k<K; k++)
+            _mm256_storeu_pd(Curr+k*Stride+h, _mm256_mul_pd(Left[k], scale));
+    }
+
+    for(; h<Length; h++)
+        LeftStepOne<K>(Prev, Curr, Site, Stride, h, Param);
+}
+
+template<int K>
+__attribute__((target("avx2")))
+static void RightStepAVX2(double *PrevRight, double *Weight, const HMMSiteData &Site,
+                          int Stride, int Length, const HMMStepParameters &Param)
+{
+    const __m256d r = _mm256_set1_pd(Param.r);
+    const __m256d complement = _mm256_set1_pd(Param.complement);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    int h = 0;
+    for(; h+4<=Length; h+=4)
+    {
+        __m256d Emission[K];
+        EmissionAVX2<K>(Site, h, Param, Emission);
+
+        __m256d Prev[K], Posterior[K];
+        __m256d sum = _mm256_setzero_pd();
+        for(int k=0; k<K; k++)
+        {
+            Prev[k] = _mm256_mul_pd(_mm256_loadu_pd(PrevRight+k*Stride+h), Emission[k]);
+            sum = _mm256_add_pd(sum, Prev[k]);
+        }
+
+        __m256d scale = _mm256_div_pd(one, sum);
+        __m256d PosteriorSum = _mm256_setzero_pd();
+        for(int k=0; k<K; k++)
+        {
+            __m256d Right = _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(complement, Prev[k]), scale));
+            _mm256_storeu_pd(PrevRight+k*Stride+h, Right);
+            Posterior[k] = _mm256_mul_pd(_mm256_loadu_pd(Weight+k*Stride+h), Right);
+            PosteriorSum = _mm256_add_pd(PosteriorSum, Posterior[k]);
+        }
+
+        __m256d PosteriorScale = _mm256_div_pd(one, PosteriorSum);
+        for(int k=0; k<K; k++)
+            _mm256_storeu_pd(Weight+k*Stride+h, _mm256_mul_pd(Posterior[k], PosteriorScale));
+    }
+
+    for(; h<Length; h++)
+        RightStepOne<K>(PrevRight, Weight, Site, Stride, h, Param);
+}
+
+template<int K, bool Renormalize>
+__attribute__((target("avx2")))
+static void InterpolateAVX2(const HMMInterpolationData &Data, float *Out, int Length,
+                            double &Sum, double &SumSq)
+{
+    const __m256d t = _mm256_set1_pd(Data.t);
+    __m256d Sums = _mm256_setzero_pd(), SumSqs = _mm256_setzero_pd();
+
+    int h = 0;
+    for(; h+4<=Length; h+=4)
+    {
+        __m256d Dosage = _mm256_setzero_pd();
+        for(int k=0; k<K; k++)
+        {
+            __m256d Weight = _mm256_add_pd(_mm256_loadu_pd(Data.Prev[k]+h), _mm256_mul_pd(t, _mm256_loadu_pd(Data.Slope[k]+h)));
+            Dosage = _mm256_add_pd(Dosage, _mm256_mul_pd(Weight, _mm256_cvtps_pd(_mm_loadu_ps(Data.Dosage[k]+h))));
+        }
+        if(Renormalize)
+            Dosage = _mm256_div_pd(Dosage, _mm256_add_pd(_mm256_loadu_pd(Data.PrevSum+h), _mm256_mul_pd(t, _mm256_loadu_pd(Data.SlopeSum+h))));
+
+        _mm_storeu_ps(Out+h, _mm256_cvtpd_ps(Dosage));
+        Sums = _mm256_add_pd(Sums, Dosage);
+        SumSqs = _mm256_add_pd(SumSqs, _mm256_mul_pd(Dosage, Dosage));
+    }
+
+    double Lanes[4], LanesSq[4];
+    _mm256_storeu_pd(Lanes, Sums);
+    _mm256_storeu_pd(LanesSq, SumSqs);
+    Sum += (Lanes[0]+Lanes[1]) + (Lanes[2]+Lanes[3]);
+    SumSq += (LanesSq[0]+LanesSq[1]) + (LanesSq[2]+LanesSq[3]);
+
+    for(; h<Length; h++)
+    {
+        double Dosage = InterpolateOne<K,Renormalize>(Data, h);
+        Out[h] = Dosage;
+        Sum += Dosage;
+        SumSq += Dosage*Dosage;
+    }
+}
+
+// Emissions of 8 haplotypes starting at h, a multiple of 8.
+template<int K>
+__attribute__((target("avx512f")))
+static inline void EmissionAVX512(const HMMSiteData &Site, int h, const HMMStepParameters &Param, __m512d *Emission)
+{
+    __mmask8 Alt = Site.GT[h>>3];
+    __m512d Offset = _mm512_mask_blend_pd(Alt, _mm512_set1_pd(Param.Offset[0]), _mm512_set1_pd(Param.Offset[1]));
+    __m512d Slope = _mm512_mask_blend_pd(Alt, _mm512_set1_pd(Param.Slope[0]), _mm512_set1_pd(Param.Slope[1]));
+
+    for(int k=0; k<K; k++)
+    {
+        // The zero-masked form converts the same way without the undefined
+        // pass-through operand that GCC warns about.
+        __m512d Dosage = _mm512_maskz_cvtepi32_pd(0xFF, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(Site.Dosage[k]+h))));
+        Emission[k] = _mm512_add_pd(Offset, _mm512_mul_pd(Slope, Dosage));
+    }
+}
+
+template<int K>
+__attribute__((target("avx512f")))
+static void LeftStepAVX512(const double *Prev, double *Curr, const HMMSiteData &Site,
+                           int Stride, int Length, const HMMStepParameters &Param)
+{
+    const __m512d r = _mm512_set1_pd(Param.r);
+    const __m512d complement = _mm512_set1_pd(Param.complement);
+    const __m512d one = _mm512_set1_pd(1.0);
+
+    int h = 0;
+    for(; h+8<=Length; h+=8)
+    {
+        __m512d Emission[K];
+        EmissionAVX512<K>(Site, h, Param, Emission);
+
+        __m512d Left[K];
+        __m512d sum = _mm512_setzero_pd();
+        for(int k=0; k<K; k++)
+        {
+            Left[k] = _mm512_add_pd(r, _mm512_mul_pd(complement, _mm512_loadu_pd(Prev+k*Stride+h)));
+            Left[k] = _mm512_mul_pd(Left[k], Emission[k]);
+            sum = _mm512_add_pd(sum, Left[k]);
+        }
+
+        __m512d scale = _mm512_div_pd(one, sum);
+        for(int k=0; k<K; k++)
+            _mm512_storeu_pd(Curr+k*Stride+h, _mm512_mul_pd(Left[k], scale));
+    }
+
+    for(; h<Length; h++)
+        LeftStepOne<K>(Prev, Curr, Site, Stride, h, Param);
+}
+
+template<int K>
+__attribute__((target("avx512f")))
+static void RightStepAVX512(double *PrevRight, double *Weight, const HMMSiteData &Site,
+                            int Stride, int Length, const HMMStepParameters &Param)
+{
+    const __m512d r = _mm512_set1_pd(Param.r);
+    const __m512d complement = _mm512_set1_pd(Param.complement);
+    const __m512d one = _mm512_set1_pd(1.0);
+
+    int h = 0;
+    for(; h+8<=Length; h+=8)
+    {
+        __m512d Emission[K];
+        EmissionAVX512<K>(Site, h, Param, Emission);
+
+        __m512d Prev[K], Posterior[K];
+        __m512d sum = _mm512_setzero_pd();
+        for(int k=0; k<K; k++)
+        {
+            Prev[k] = _mm512_mul_pd(_mm512_loadu_pd(PrevRight+k*Stride+h), Emission[k]);
+            sum = _mm512_add_pd(sum, Prev[k]);
+        }
+
+        __m512d scale = _mm512_div_pd(one, sum);
+        __m512d PosteriorSum = _mm512_setzero_pd();
+        for(int k=0; k<K; k++)
+        {
+            __m512d Right = _mm512_add_pd(r, _mm512_mul_pd(_mm512_mul_pd(complement, Prev[k]), scale));
+            _mm512_storeu_pd(PrevRight+k*Stride+h, Right);
+            Posterior[k] = _mm512_mul_pd(_mm512_loadu_pd(Weight+k*Stride+h), Right);
+            PosteriorSum = _mm512_add_pd(PosteriorSum, Posterior[k]);
+        }
+
+        __m512d PosteriorScale = _mm512_div_pd(one, PosteriorSum);
+        for(int k=0; k<K; k++)
+            _mm512_storeu_pd(Weight+k*Stride+h, _mm512_mul_pd(Posterior[k], PosteriorScale));
+    }
+
+    for(; h<Length; h++)
+        RightStepOne<K>(PrevRight, Weight, Site, Stride, h, Param);
+}
+
+// Sum of the lanes of X, added in the order _mm512_reduce_add_pd uses, but
+// through memory to avoid the undefined operands GCC warns about.
+__attribute__((target("avx512f")))
+static inline double ReduceAVX512(__m512d X)
+{
+    alignas(64) double Lanes[8];
+    _mm512_store_pd(Lanes, X);
+    return ((Lanes[0]+Lanes[4]) + (Lanes[2]+Lanes[6])) + ((Lanes[1]+Lanes[5]) + (Lanes[3]+Lanes[7]));
+}
+
+template<int K, bool Renormalize>
+__attribute__((target("avx512f")))
+static void InterpolateAVX512(const HMMInterpolationData &Data, float *Out, int Length,
+                              double &Sum, double &SumSq)
+{
+    const __m512d t = _mm512_set1_pd(Data.t);
+    __m512d Sums = _mm512_setzero_pd(), SumSqs = _mm512_setzero_pd();
+
+    int h = 0;
+    for(; h+8<=Length; h+=8)
+    {
+        __m512d Dosage = _mm512_setzero_pd();
+        for(int k=0; k<K; k++)
+        {
+            __m512d Weight = _mm512_add_pd(_mm512_loadu_pd(Data.Prev[k]+h), _mm512_mul_pd(t, _mm512_loadu_pd(Data.Slope[k]+h)));
+            Dosage = _mm512_add_pd(Dosage, _mm512_mul_pd(Weight, _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(Data.Dosage[k]+h))));
+        }
+        if(Renormalize)
+            Dosage = _mm512_div_pd(Dosage, _mm512_add_pd(_mm512_loadu_pd(Data.PrevSum+h), _mm512_mul_pd(t, _mm512_loadu_pd(Data.SlopeSum+h))));
+
+        _mm256_storeu_ps(Out+h, _mm512_maskz_cvtpd_ps(0xFF, Dosage));
+        Sums = _mm512_add_pd(Sums, Dosage);
+        SumSqs = _mm512_add_pd(SumSqs, _mm512_mul_pd(Dosage, Dosage));
+    }
+
+    Sum += ReduceAVX512(Sums);
+    SumSq += ReduceAVX512(SumSqs);
+
+    for(; h<Length; h++)
+    {
+        double Dosage = InterpolateOne<K,Renormalize>(Data, h);
+        Out[h] = Dosage;
+        Sum += Dosage;
+        SumSq += Dosage*Dosage;
+    }
+}
+
+#endif
+
+
+template<int K>
+void HMMKernels::Select()
+{
+    Name = "scalar";
+    LeftStep = LeftStepScalar<K>;
+    RightStep = RightStepScalar<K>;
+
+#ifdef METAM_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+    {
+        Name = "AVX-512";
+        LeftStep = LeftStepAVX512<K>;
+        RightStep = RightStepAVX512<K>;
+    }
+    else if(__builtin_cpu_supports("avx2"))
+    {
+        Name = "AVX2";
+        LeftStep = LeftStepAVX2<K>;
+        RightStep = RightStepAVX2<K>;
+    }
+#endif
+}
+
+template<int K>
+void HMMKernels::SelectInterpolate()
+{
+    Interpolate[K][0] = InterpolateScalar<K,false>;
+    Interpolate[K][1] = InterpolateScalar<K,true>;
+    InterpolateAt[K][0] = InterpolateAtScalar<K,false>;
+    InterpolateAt[K][1] = InterpolateAtScalar<K,true>;
+
+#ifdef METAM_X86_KERNELS
+    if(__builtin_cpu_supports("avx512f"))
+    {
+        Interpolate[K][0] = InterpolateAVX512<K,false>;
+        Interpolate[K][1] = InterpolateAVX512<K,true>;
+    }
+    else if(__builtin_cpu_supports("avx2"))
+    {
+        Interpolate[K][0] = InterpolateAVX2<K,false>;
+        Interpolate[K][1] = InterpolateAVX2<K,true>;
+    }
+#endif
+}
+
+HMMKernels::HMMKernels()
+{
+    Name = "scalar";
+    LeftStep = NULL;
+    RightStep = NULL;
+    for(int k=0; k<=MAXSTUDIES; k++)
+    {
+        Interpolate[k][0] = Interpolate[k][1] = NULL;
+        InterpolateAt[k][0] = InterpolateAt[k][1] = NULL;
+    }
+}
+
+void HMMKernels::Initialize(int NoStudies)
+{
+    switch(NoStudies)
+    {
+        case 2: Select<2>(); break;
+        case 3: Select<3>(); break;
+        case 4: Select<4>(); break;
+        default: abort();
+    }
+
+    // Variants are interpolated over the studies that carry them, so every
+    // subset size up to NoStudies gets its own kernels.
+    if(NoStudies >= 2) SelectInterpolate<2>();
+    if(NoStudies >= 3) SelectInterpolate<3>();
+    if(NoStudies >= 4) SelectInterpolate<4>();
+}
@@ -0,0 +1,105 @@
+#ifndef METAM_HMMKERNELS_H
+#define METAM_HMMKERNELS_H
+
+// Vectorized single-site steps of the forward/backward passes.
+//
+// Every kernel works on a contiguous range of haplotypes of one typed site and
+// is instantiated for each supported number of studies K, so that all loops
+// over studies are unrolled and per-study values stay in registers.
+// Weights are laid out as NoStudies rows of haplotypes (see WeightTensor),
+// so one SIMD lane holds one haplotype. The transition is a uniform jump
+// plus stay, which is applied in its rank-1 form
+//
+//      New[k] = r * Sum_j Old[j] + (1-Recom) * Old[k],   r = Recom/NoStudies
+//
+// in O(K) instead of the O(K^2) double loop. Emissions are formed on the
+// fly from the packed training data of the site (see PackedTypedData) as
+//
+//      Emission[k] = Offset[GT] + Slope[GT] * Dosage[k]
+//
+// from the 16-bit LOO dosage of study k and the typed genotype bit.
+// Every step rescales its output to sum to one, which keeps the chains
+// away from underflow without any data-dependent branches. Since the
+// incoming probabilities already sum to one, Sum_j Old[j] is simply 1.
+// Weights agree with the unscaled double loop to a relative error below
+// 1e-12, far below the 4 decimals printed for weights and 3 decimals for
+// dosages.
+
+#define MAXSTUDIES 4
+
+struct HMMStepParameters
+{
+    double r, complement;
+    double Offset[2], Slope[2];
+};
+
+// Packed training data of one typed site, offset to the first haplotype of
+// the range a kernel works on. That haplotype must be a multiple of 8.
+struct HMMSiteData
+{
+    const unsigned short *Dosage[MAXSTUDIES];
+    const unsigned char *GT;
+};
+
+// Left (right-to-left) step at one site, from normalized Prev:
+//      Curr[k] = (r + complement*Prev[k]) * Emission[k],  normalized
+typedef void (*LeftStepKernel)(const double *Prev, double *Curr, const HMMSiteData &Site,
+                               int Stride, int Length, const HMMStepParameters &Param);
+
+// Right (left-to-right) step at one site. The emission of the previous site
+// is folded in and the result carried over, then the posterior is formed:
+//      PrevRight[k] = r + complement*(PrevRight[k]*Emission[k]),  with
+//                     PrevRight*Emission normalized first
+//      Weight[k]    = Weight[k]*PrevRight[k],  normalized
+typedef void (*RightStepKernel)(double *PrevRight, double *Weight, const HMMSiteData &Site,
+                                int Stride, int Length, const HMMStepParameters &Param);
+
+// Weights and dosages of the studies carrying one untyped variant, at the
+// fraction t of the way between two typed sites.
+struct HMMInterpolationData
+{
+    const double *Prev[MAXSTUDIES], *Slope[MAXSTUDIES];
+    const float *Dosage[MAXSTUDIES];
+    const double *PrevSum, *SlopeSum;
+    double t;
+};
+
+// Meta-imputed dosages of one untyped variant carried by k studies:
+//      Out = Sum_k (Prev[k] + t*Slope[k]) * Dosage[k]
+// divided by PrevSum + t*SlopeSum when only some of the studies carry it.
+// The sum and sum of squares of Out over the range are accumulated in
+// double alongside for AF and R2.
+typedef void (*InterpolateKernel)(const HMMInterpolationData &Data, float *Out, int Length,
+                                  double &Sum, double &SumSq);
+
+// As above, but only at the NoHaps haplotypes listed in Haps, for rare
+// variants that are zero everywhere else.
+typedef void (*InterpolateAtKernel)(const HMMInterpolationData &Data, const int *Haps, int NoHaps,
+                                    float *Out, double &Sum, double &SumSq);
+
+class HMMKernels
+{
+public:
+
+    const char *Name;
+    LeftStepKernel LeftStep;
+    RightStepKernel RightStep;
+
+    // Indexed by the number of studies carrying a variant and by whether it
+    // has to be renormalized.
+    InterpolateKernel Interpolate[MAXSTUDIES+1][2];
+    InterpolateAtKernel InterpolateAt[MAXSTUDIES+1][2];
+
+    HMMKernels();
+
+    // Picks the kernels for NoStudies panels using the widest instruction
+    // set supported by the running CPU.
+    void Initialize(int NoStudies);
+
+private:
+
+    template<int K> void Select();
+    template<int K> void SelectInterpolate();
+};
+
+#endif //METAM_HMMKERNELS_H
@@ -1,5 +1,6 @@
 #include "HaplotypeSet.h"
 #include "assert.h"
+#include <iostream>
 
 bool HaplotypeSet::LoadSampleNames(string prefix)
 {
@@ -21,17 +22,15 @@ bool HaplotypeSet::LoadSampleNames(string prefix)
 
 bool HaplotypeSet::GetSampleInformationfromHDS(string filename)
 {
-    VcfFileReader inFile;
-    VcfHeader header;
-    VcfRecord record;
+    VcfRecordReader inFile;
     individualName.clear();
 
-    if (!inFile.open(filename.c_str(), header))
+    if (!inFile.Open(filename.c_str(), NoReadThreads))
     {
         cout << "\n Program could NOT open file : " << filename << endl<<endl;
         return false;
     }
-    numSamples = header.getNumSamples();
+    numSamples = inFile.SampleNames.size();
     if(numSamples==0)
     {
         std::cout << "\n Number of Samples read from VCF File    : " << numSamples << endl;
@@ -39,38 +38,28 @@ bool HaplotypeSet::GetSampleInformationfromHDS(string filename)
         cout << "\n NO samples found in VCF File !! \n Please Check Input File !!!  "<< endl;
         return false;
     }
-    individualName.resize(numSamples);
+    individualName = inFile.SampleNames;
     CummulativeSampleNoHaplotypes.resize(numSamples);
     SampleNoHaplotypes.resize(numSamples);
 
-    for (int i = 0; i < numSamples; i++)
-    {
-        individualName[i]=header.getSampleName(i);
-    }
-
-    inFile.setSiteOnly(false);
-    inFile.readRecord(record);
-
-
-    VcfRecordGenotype &ThisGenotype=record.getGenotypeInfo();
+    inFile.ReadRecord();
+    int HDSIndex = inFile.GetFormatIndex("HDS");
 
     int tempHapCount=0;
     for (int i = 0; i<(numSamples); i++)
     {
-        string temp=*ThisGenotype.getString("HDS",i);
-        char *end_str;
-
-        char *pch = strtok_r((char *) temp.c_str(), ",", &end_str);
-        if(pch==NULL)
+        const char *Field = inFile.GetSampleField(i, HDSIndex);
+        if(*Field==':' || *Field=='\t' || *Field=='\0')
         {
             std::cout << "\n ERROR !!! \n Empty Value for Individual : " << individualName[i] << " at First Marker  " << endl;
             std::cout << " Most probably a corrupted VCF file. Please check input VCF file !!! " << endl;
             cout << "\n Program Exiting ... \n\n";
             return false;
         }
-        char *pch1 = strtok_r(NULL, "\t", &end_str);
+        while(*Field!=',' && *Field!=':' && *Field!='\t' && *Field!='\0')
+            Field++;
 
-        if(pch1==NULL)
+        if(*Field!=',')
         {
             SampleNoHaplotypes[i]=1;
         }
@@ -83,7 +72,7 @@ bool HaplotypeSet::GetSampleInformationfromHDS(string filename)
         tempHapCount+=SampleNoHaplotypes[i];
     }
 
-    inFile.close();
+    inFile.Close();
 
     return true;
 
@@ -92,17 +81,15 @@ bool HaplotypeSet::GetSampleInformationfromHDS(string filename)
 
 bool HaplotypeSet::GetSampleInformation(string filename)
 {
-    VcfFileReader inFile;
-    VcfHeader header;
-    VcfRecord record;
+    VcfRecordReader inFile;
     individualName.clear();
 
-    if (!inFile.open(filename.c_str(), header))
+    if (!inFile.Open(filename.c_str(), NoReadThreads))
     {
         cout << "\n Program could NOT open file : " << filename << endl<<endl;
         return false;
     }
-    numSamples = header.getNumSamples();
+    numSamples = inFile.SampleNames.size();
     if(numSamples==0)
     {
         std::cout << "\n Number of Samples read from VCF File    : " << numSamples << endl;
@@ -110,21 +97,23 @@ bool HaplotypeSet::GetSampleInformation(string filename)
         cout << "\n NO samples found in VCF File !! \n Please Check Input File !!!  "<< endl;
         return false;
     }
-    individualName.resize(numSamples);
+    individualName = inFile.SampleNames;
     CummulativeSampleNoHaplotypes.resize(numSamples);
     SampleNoHaplotypes.resize(numSamples);
 
-    for (int i = 0; i < numSamples; i++)
-    {
-        individualName[i]=header.getSampleName(i);
-    }
-
-    inFile.setSiteOnly(false);
-    inFile.readRecord(record);
+    inFile.ReadRecord();
+    int GTIndex = inFile.GetFormatIndex("GT");
     int tempHapCount=0;
     for (int i = 0; i<(numSamples); i++)
     {
-        if(record.getNumGTs(i)==0)
+        // Number of alleles in GT
+        const char *Field = inFile.GetSampleField(i, GTIndex);
+        int NoGTs = 0;
+        if(*Field!=':' && *Field!='\t' && *Field!='\0')
+            for(NoGTs=1; *Field!=':' && *Field!='\t' && *Field!='\0'; Field++)
+                NoGTs += (*Field=='|' || *Field=='/');
+
+        if(NoGTs==0)
         {
             std::cout << "\n ERROR !!! \n Empty Value for Individual : " << individualName[i] << " at First Marker  " << endl;
             std::cout << " Most probably a corrupted VCF file. Please check input VCF file !!! " << endl;
@@ -134,11 +123,11 @@ bool HaplotypeSet::GetSampleInformation(string filename)
         else
         {
             CummulativeSampleNoHaplotypes[i]=tempHapCount;
-            SampleNoHaplotypes[i]=(record.getNumGTs(i));
+            SampleNoHaplotypes[i]=NoGTs;
             tempHapCount+=SampleNoHaplotypes[i];
         }
     }
-    inFile.close();
+    inFile.Close();
     numActualHaps=tempHapCount;
 
     return true;
@@ -175,78 +164,66 @@ bool HaplotypeSet::CheckSampleConsistency(int tempNoSamples,
     return true;
 }
 
-void HaplotypeSet::LoadEmpVariantList()
+void HaplotypeSet::OpenEmpVariantStream()
 {
-    VcfFileReader inFile;
-    VcfHeader header;
-    VcfRecord record;
-    inFile.open(EmpDoseFileName.c_str(), header);
-    inFile.setSiteOnly(true);
-    TypedVariantList.clear();
+    EmpVariantStream = new VcfRecordReader();
+    EmpVariantStream->Open(EmpDoseFileName.c_str(), NoReadThreads);
+    noTypedMarkers = 0;
+}
 
-    int numReadRecords=0;
+bool HaplotypeSet::ReadEmpVariant(variant &ThisVariant)
+{
+    VcfRecordReader &record = *EmpVariantStream;
+    if(!record.ReadRecord())
+        return false;
 
-    while (inFile.readRecord(record))
-    {
-        ++numReadRecords;
-        if(numReadRecords==1)
-            finChromosome = record.getChromStr();
-
-        variant tempVariant;
-        tempVariant.chr=record.getChromStr();
-        tempVariant.bp=record.get1BasedPosition();
-        tempVariant.altAlleleString = record.getAltStr();
-        tempVariant.refAlleleString = record.getRefStr();
-        tempVariant.name=tempVariant.chr+":"+to_string(tempVariant.bp)+":"+ tempVariant.refAlleleString+":"+tempVariant.altAlleleString;
-        TypedVariantList.push_back(tempVariant);
-    }
+    if(++noTypedMarkers==1)
+        finChromosome = record.GetChromStr();
+
+    ThisVariant.chr=record.GetChromStr();
+    ThisVariant.bp=record.Get1BasedPosition();
+    ThisVariant.altAlleleString = record.GetAltStr();
+    ThisVariant.refAlleleString = record.GetRefStr();
+    ThisVariant.key=GetVariantKey(ThisVariant.bp, record.GetRefStr(), record.GetAltStr());
+    return true;
+}
 
-    noTypedMarkers=TypedVariantList.size();
-    inFile.close();
+void HaplotypeSet::CloseEmpVariantStream()
+{
+    EmpVariantStream->Close();
+    delete EmpVariantStream;
+    EmpVariantStream = NULL;
 }
 
-void HaplotypeSet::ClearEmpVariantList()
+int HaplotypeSet::GetNoHaplotypes(int StartSamId, int EndSamId)
 {
-    TypedVariantList.clear();
+    return CummulativeSampleNoHaplotypes[EndSamId-1] + SampleNoHaplotypes[EndSamId-1] - CummulativeSampleNoHaplotypes[StartSamId];
 }
 
-void HaplotypeSet::ReadBasedOnSortCommonGenotypeList(vector<string> &SortedCommonGenoList, int StartSamId, int EndSamId)
+void HaplotypeSet::ReadBasedOnSortCommonGenotypeList(vector<variant> &SortedCommonGenoList, int StartSamId, int EndSamId)
 
 {
-    VcfFileReader inFile;
-    VcfHeader header;
-    VcfRecord record;
-    VcfRecordGenotype *recordGeno;
-    inFile.open(EmpDoseFileName.c_str(), header);
-    inFile.setSiteOnly(false);
-    int bp,numReadRecords=0;
-    int numHapsInBatch = 2*(EndSamId - StartSamId);
-    string cno,name,refAllele,altAllele,prevID="",currID;
-
-    LooDosage.clear();
-    TypedGT.clear();
-    LooDosage.resize(numHapsInBatch);
-    TypedGT.resize(numHapsInBatch);
-    for(int i=0; i<numHapsInBatch; i++)
-    {
-        LooDosage[i].resize(SortedCommonGenoList.size());
-        TypedGT[i].resize(SortedCommonGenoList.size());
-    }
+    VcfRecordReader inFile;
+    inFile.Open(EmpDoseFileName.c_str(), NoReadThreads);
+    inFile.SetSampleRange(StartSamId, EndSamId);
+    int numReadRecords=0;
+    int numHapsInBatch = GetNoHaplotypes(StartSamId, EndSamId);
+
+    TypedData.Resize(SortedCommonGenoList.size(), numHapsInBatch);
     int SortIndex = 0;
     int numComRecord = 0;
-    while (inFile.readRecord(record))
+    while (inFile.ReadRecord())
     {
         ++numReadRecords;
-        cno=record.getChromStr();
-        bp=record.get1BasedPosition();
-        altAllele = record.getAltStr();
-        refAllele = record.getRefStr();
-        name = cno+":"+to_string(bp)+":"+refAllele+":"+altAllele;
+        if(SortIndex==(int)SortedCommonGenoList.size())
+            break;
 
-        if(SortedCommonGenoList[SortIndex]==name)
+        variant &Common = SortedCommonGenoList[SortIndex];
+        if(Common.key==GetVariantKey(inFile.Get1BasedPosition(), inFile.GetRefStr(), inFile.GetAltStr())
+           && SameVariant(Common.key, Common.bp, Common.refAlleleString.c_str(), Common.altAlleleString.c_str(),
+                          inFile.Get1BasedPosition(), inFile.GetRefStr(), inFile.GetAltStr()))
         {
-            recordGeno=&record.getGenotypeInfo();
-            LoadLooVariant(*recordGeno, numComRecord, StartSamId, EndSamId);
+            LoadLooVariant(inFile, numComRecord, StartSamId, EndSamId);
             numComRecord++;
             SortIndex++;
         }
@@ -257,39 +234,30 @@ void HaplotypeSet::ReadBasedOnSortCommonGenotypeList(vector<string> &SortedCommo
         abort();
     }
 
-    inFile.close();
+    inFile.Close();
 }
 
-void HaplotypeSet::LoadLooVariant(VcfRecordGenotype &ThisGenotype,int loonumReadRecords, int StartSamId, int EndSamId)
+void HaplotypeSet::LoadLooVariant(VcfRecordReader &Record, int loonumReadRecords, int StartSamId, int EndSamId)
 {
+    int LDSIndex = Record.GetFormatIndex("LDS");
+    int GTIndex = Record.GetFormatIndex("GT");
     int NoHapsLoad = 0;
     for (int i = StartSamId; i<EndSamId; i++)
     {
-        string temp=*ThisGenotype.getString("LDS",i);
-        if(SampleNoHaplotypes[i]==2)
+        // LDS and GT hold one value per haplotype, separated by '|'
+        const char *LooDosage = Record.GetSampleField(i, LDSIndex);
+        const char *GT = Record.GetSampleField(i, GTIndex);
+        for(int j=0; j<SampleNoHaplotypes[i]; j++)
         {
-            char *end_str;
-            char *pch = strtok_r((char *) temp.c_str(), "|", &end_str);
-            LooDosage[2*NoHapsLoad][loonumReadRecords] = atof(pch);
-            pch = strtok_r(NULL, "\t", &end_str);
-            LooDosage[2*NoHapsLoad + 1][loonumReadRecords] = atof(pch);
-
-
-            temp = *ThisGenotype.getString("GT", i);
-            char *end_str1;
-            char *pch1 = strtok_r((char *) temp.c_str(), "|", &end_str1);
-            TypedGT[2*NoHapsLoad][loonumReadRecords] = atof(pch1);
-            pch1 = strtok_r(NULL, "\t", &end_str1);
-            TypedGT[2*NoHapsLoad+1][loonumReadRecords] = atof(pch1);
+            if(j > 0)
+            {
+                LooDosage += (*LooDosage=='|');
+                GT += (*GT=='|');
+            }
+            float ThisLooDosage = VcfRecordReader::ParseFloat(LooDosage, &LooDosage);
+            bool ThisGT = VcfRecordReader::ParseFloat(GT, &GT)==1;
+            TypedData.Set(loonumReadRecords, NoHapsLoad++, ThisLooDosage, ThisGT);
         }
-        else
-        {
-            LooDosage[2*NoHapsLoad][loonumReadRecords] = atof(temp.c_str());
-            temp = *ThisGenotype.getString("GT", i);
-            TypedGT[2*NoHapsLoad][loonumReadRecords] = atof(temp.c_str());
-
-        }
-        NoHapsLoad++;
     }
 }
 
@@ -323,46 +291,81 @@ bool HaplotypeSet::CheckSuffixFile(string prefix, const char* suffix, string &Fi
     return true;
 }
 
-void HaplotypeSet::LoadData(int VariantId, VcfRecordGenotype &ThisGenotype, int StartSamId, int EndSamId)
+void HaplotypeSet::LoadData(int VariantId, VcfRecordReader &Record, int StartSamId, int EndSamId)
 {
+    if(VariantId >= (int)VariantId2Buffer.size())
+        VariantId2Buffer.resize(VariantId+1, -1);
     VariantId2Buffer[VariantId] = BufferNoVariants;
 
-    vector<float> tempHapDosage;
-    tempHapDosage.resize(2*(EndSamId-StartSamId), 0.0);
+    BufferNoHaps = GetNoHaplotypes(StartSamId, EndSamId);
+    size_t Required = (size_t)(BufferNoVariants+1)*BufferNoHaps;
+    if(BufferHapDosage.size() < Required)
+        BufferHapDosage.resize(max(Required, 2*BufferHapDosage.size()));
+    float *tempHapDosage = &BufferHapDosage[(size_t)BufferNoVariants*BufferNoHaps];
 
+    if(BufferNoVariants == 0)
+        BufferNonZeroHaps.clear();
+    if(BufferNoVariants == (int)BufferNonZeroStart.size())
+    {
+        BufferNonZeroStart.push_back(-1);
+        BufferNoNonZero.push_back(0);
+    }
+    int NonZeroStart = BufferNonZeroHaps.size();
+    int MaxNonZero = BufferNoHaps/4;
+    bool Sparse = true;
+
+    int HDSIndex = Record.GetFormatIndex("HDS");
+    int NoHapsLoad = 0;
     for (int i = StartSamId; i<EndSamId; i++)
     {
-        string temp=*ThisGenotype.getString("HDS",i);
-        char *end_str;
+        const char *Field = Record.GetSampleField(i, HDSIndex);
 
         if(SampleNoHaplotypes[i]==2) {
-            char *pch = strtok_r((char *) temp.c_str(), ",", &end_str);
-            tempHapDosage[2*(i-StartSamId)] = atof(pch);
-
-            pch = strtok_r(NULL, "\t", &end_str);
-            tempHapDosage[2*(i-StartSamId)+1] = atof(pch);
+            tempHapDosage[NoHapsLoad++] = VcfRecordReader::ParseFloat(Field, &Field);
+            Field += (*Field==',');
+            tempHapDosage[NoHapsLoad++] = VcfRecordReader::ParseFloat(Field, &Field);
         }
         else
         {
-            tempHapDosage[2*(i-StartSamId)] = atof(temp.c_str());
+            tempHapDosage[NoHapsLoad++] = VcfRecordReader::ParseFloat(Field, &Field);
         }
 
+        if(Sparse)
+        {
+            for(int hap=NoHapsLoad-SampleNoHaplotypes[i]; hap<NoHapsLoad; hap++)
+                if(tempHapDosage[hap] != 0.0f)
+                    BufferNonZeroHaps.push_back(hap);
+            if((int)BufferNonZeroHaps.size()-NonZeroStart > MaxNonZero)
+            {
+                BufferNonZeroHaps.resize(NonZeroStart);
+                Sparse = false;
+            }
+        }
     }
 
-    BufferHapDosage.push_back(tempHapDosage);
+    BufferNonZeroStart[BufferNoVariants] = Sparse ? NonZeroStart : -1;
+    BufferNoNonZero[BufferNoVariants] = BufferNonZeroHaps.size()-NonZeroStart;
     BufferNoVariants++;
 
 }
 
-void HaplotypeSet::GetData(int VariantId)
+const float* HaplotypeSet::GetData(int VariantId)
+{
+    return &BufferHapDosage[(size_t)VariantId2Buffer[VariantId]*BufferNoHaps];
+}
+
+int HaplotypeSet::GetNonZeroHaps(int VariantId, const int *&Haps)
 {
-    int index=VariantId2Buffer[VariantId];
-    CurrentHapDosage=BufferHapDosage[index];
+    // Number of haplotypes with nonzero dosage, or -1 for dense variants.
+    int BufferId = VariantId2Buffer[VariantId];
+    if(BufferNonZeroStart[BufferId] < 0)
+        return -1;
+    Haps = BufferNonZeroHaps.data() + BufferNonZeroStart[BufferId];
+    return BufferNoNonZero[BufferId];
 }
 
 void HaplotypeSet::ClearBuffer()
 {
-    BufferHapDosage.clear();
     BufferNoVariants = 0;
     VariantId2Buffer.clear();
 }
\ No newline at end of file
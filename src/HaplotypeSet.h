@@ -1,8 +1,10 @@
 #ifndef METAM_HAPLOTYPESET_H
 #define METAM_HAPLOTYPESET_H
 
-#include "VcfFileReader.h"
-#include "VcfHeader.h"
+#include "StringBasics.h"
+#include "VcfRecordReader.h"
+#include "PackedTypedData.h"
+#include "VariantKey.h"
 #include "assert.h"
 
 using namespace std;
@@ -12,6 +14,7 @@ class variant
 public:
 
     string name;
+    unsigned long long key;
     int bp;
     string chr;
     string refAlleleString,altAlleleString;
@@ -38,6 +41,9 @@ public:
     string DoseFileName;
     string EmpDoseFileName;
 
+    // Threads for inflating BGZF inputs
+    int NoReadThreads;
+
     // Summary Variables
     int         numSamples;
     int         numActualHaps;
@@ -45,39 +51,55 @@ public:
     vector<int> SampleNoHaplotypes;
     vector<int> CummulativeSampleNoHaplotypes;
     vector<variant> VariantList;
-    vector<variant> TypedVariantList;
     int noMarkers;
     int noTypedMarkers;
     string finChromosome;
 
 
     // Dosage Data
-    vector<float> CurrentHapDosage;
-    vector<vector<float> > LooDosage;
-    vector<vector<float> > TypedGT;
+    PackedTypedData TypedData;
+
+    // Buffer Data: haplotype dosages of the buffered variants in one slab
+    // of BufferNoHaps floats per variant, kept across buffer flushes.
+    int BufferNoVariants, BufferNoHaps;
+    vector<float> BufferHapDosage;
+    vector<int> VariantId2Buffer;
 
-    // Buffer Data
-    int BufferNoVariants;
-    vector<vector<float> > BufferHapDosage;
-    map<int,int> VariantId2Buffer;
+    // Rare variants: the haplotypes with nonzero dosage of each buffered
+    // variant, in order, for variants where they are at most a quarter of
+    // all haplotypes. BufferNonZeroStart holds the offsets of the lists,
+    // or -1 for dense variants.
+    vector<int> BufferNonZeroHaps;
+    vector<int> BufferNonZeroStart, BufferNoNonZero;
 
+    // Site-only stream over the empiricalDose file
+    VcfRecordReader *EmpVariantStream;
 
+    HaplotypeSet()
+    {
+        BufferNoVariants = BufferNoHaps = 0;
+        EmpVariantStream = NULL;
+        NoReadThreads = 1;
+    };
 
     // FUNCTIONS
+    int         GetNoHaplotypes                         (int StartSamId, int EndSamId);
     bool        CheckSampleConsistency                  (int tempNoSamples, vector<string> &tempindividualName, vector<int> tempSampleNoHaplotypes, string File1, string File2);
-    void        ReadBasedOnSortCommonGenotypeList       (vector<string> &SortedCommonGenoList, int StartSamId, int EndSamId);
+    void        ReadBasedOnSortCommonGenotypeList       (vector<variant> &SortedCommonGenoList, int StartSamId, int EndSamId);
     bool        CheckSuffixFile                         (string prefix, const char* suffix, string &FinalName);
 
     bool        GetSampleInformation                    (string filename);
     bool        GetSampleInformationfromHDS             (string filename);
-    void        LoadEmpVariantList                      ();
-    void        ClearEmpVariantList                     ();
-    void        LoadLooVariant                          (VcfRecordGenotype &ThisGenotype,int loonumReadRecords, int StartSamId, int EndSamId);
+    void        OpenEmpVariantStream                    ();
+    bool        ReadEmpVariant                          (variant &ThisVariant);
+    void        CloseEmpVariantStream                   ();
+    void        LoadLooVariant                          (VcfRecordReader &Record, int loonumReadRecords, int StartSamId, int EndSamId);
     bool        LoadSampleNames                         (string prefix);
     bool        doesExistFile                           (string filename);
 
-    void        LoadData                                (int VariantId, VcfRecordGenotype &ThisGenotype, int StartSamId, int EndSamId);
-    void        GetData                                 (int VariantId);
+    void        LoadData                                (int VariantId, VcfRecordReader &Record, int StartSamId, int EndSamId);
+    const float* GetData                                (int VariantId);
+    int         GetNonZeroHaps                          (int VariantId, const int *&Haps);
     void        ClearBuffer                             ();
 };
 
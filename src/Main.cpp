@@ -22,11 +22,15 @@ int main(int argc, char ** argv)
                     {"nobgzip",no_argument,NULL,'n'},
                     {"log",no_argument,NULL,'l'},
                     {"weight",no_argument,NULL,'w'},
+                    {"threads",required_argument,NULL,'t'},
+                    {"checkpoint",no_argument,NULL,'c'},
+                    {"precision",required_argument,NULL,'p'},
+                    {"minimizer",required_argument,NULL,'m'},
                     {"help",no_argument,NULL,'h'},
                     {NULL,0,NULL,0}
             };
 
-    while ((c = getopt_long(argc, argv, "i:o:v:f:snlwh",loptions,NULL)) >= 0)
+    while ((c = getopt_long(argc, argv, "i:o:v:f:t:p:m:csnlwh",loptions,NULL)) >= 0)
     {
         switch (c) {
             case 'i': myAnalysis.myUserVariables.inputFiles = optarg; break;
@@ -38,6 +42,10 @@ int main(int argc, char ** argv)
             case 'v': myAnalysis.myUserVariables.VcfBuffer=atoi(optarg); break;
             case 'h': help=true; break;
             case 'l': myAnalysis.myUserVariables.log=true; break;
+            case 't': myAnalysis.myUserVariables.cpus=atoi(optarg); break;
+            case 'c': myAnalysis.myUserVariables.checkpoint=true; break;
+            case 'p': myAnalysis.myUserVariables.precision = optarg; break;
+            case 'm': myAnalysis.myUserVariables.minimizer = optarg; break;
             case '?': helpFile(); return 1;
             default:  printf("[ERROR:] Unknown argument: %s\n", optarg);
         }
@@ -117,6 +125,13 @@ void helpFile()
     printf( "   -s, --skipInfo                      If ON, the INFO fields are removed from the output file.\n");
     printf( "   -n, --nobgzip                       If ON, output files will NOT be bgzipped.\n");
     printf( "   -w, --weight                        If ON, weights will be saved in $prefix.metaWeights(.gz)\n");
+    printf( "   -t, --threads <int>                 Number of threads used to estimate weights and to read BGZF inputs [1]\n");
+    printf( "   -c, --checkpoint                    If ON, forward probabilities are kept at checkpoints only and recomputed,\n");
+    printf( "                                       which allows much larger sample batches at the same memory.\n");
+    printf( "   -p, --precision <string>            Storage of weights: double, float or half [double]; float and half\n");
+    printf( "                                       cut weight memory 2-8x, half may change the last digit of dosages.\n");
+    printf( "   -m, --minimizer <string>            Fit of the initial weights: activeSet or simplex [activeSet]; simplex\n");
+    printf( "                                       runs the original Nelder-Mead search, for validation.\n");
     printf( "   -l, --log                           If ON, log will be written to $prefix.logfile. \n");
     printf( "   -h, --help                          If ON, detailed help on options and usage. \n");
     cout<<endl<<endl;
@@ -1,4 +1,6 @@
 #include "MarkovModel.h"
+#include <cmath>
+#include <limits>
 
 
 
@@ -172,64 +174,172 @@
 //}
 
 
-double LogOddsModel::operator()(vector<double> x)
+template<int K>
+double LogOddsModel<K>::operator()(const vector<double> &x)
 {
-    vector<double> tempVar(NoStudies);
-    double sum=0.0;
+    double tempVar[K];
+    logitTransform<K>(&x[0],tempVar);
 
+    // Sum over markers of (w'Dosage - GT)^2 = w'Gw - 2b'w + GT'GT
+    double sum=GTSumSq;
+    for(int i=0; i<K; i++)
+    {
+        double temp = -2.0*Proj[i];
+        for(int j=0; j<K; j++)
+            temp += Gram[i][j]*tempVar[j];
+        sum += temp*tempVar[i];
+    }
+    return sum;
+}
 
-    logitTransform(x,tempVar);
+template<int K>
+void LogOddsModel<K>::accumulate(MetaMinimac *const ThisStudy, int HapStart, int HapEnd)
+{
+    WeightTensor &Fit = ThisStudy->FitEquations;
+    int Stride = Fit.HapStride;
+    double *Out = Fit.Site(0);
+    for(int r=0; r<NoRows; r++)
+        memset(Out + r*Stride + HapStart, 0, (HapEnd-HapStart)*sizeof(double));
 
-    for(int ThisMarker=0;ThisMarker<NoMarkers;ThisMarker++)
-    {
+    int NoCommonVariants = ThisStudy->NoCommonTypedVariants;
+    int NoMarkers = min(400, NoCommonVariants);
+    const float Scale = (float)(1.0/LOO_DOSAGE_SCALE);
 
-        double temp=0.0;
+    for(int ThisMarker=0; ThisMarker<NoMarkers; ThisMarker++)
+    {
+        int TypedId = NoCommonVariants-ThisMarker-1;
+        const unsigned short *Dosage[K];
+        for(int i=0; i<K; i++)
+            Dosage[i] = ThisStudy->InputData[i].TypedData.Dosage(TypedId);
+        const unsigned char *GT = ThisStudy->InputData[0].TypedData.GT(TypedId);
 
-        for(int j=0;j<NoStudies;j++)
+        #pragma omp simd
+        for(int h=HapStart; h<HapEnd; h++)
         {
-            temp+=((tempVar[j])*(LooDosageVal[j][ThisMarker]));
-        }
-
-        temp-=(ChipGTVal)[ThisMarker];
-        temp=temp*temp;
-        sum+=temp;
+            double d[K];
+            for(int i=0; i<K; i++)
+                d[i] = Dosage[i][h]*Scale;
+            double g = (GT[h>>3] >> (h&7)) & 1;
 
+            int r = 0;
+            for(int i=0; i<K; i++)
+                for(int j=0; j<=i; j++, r++)
+                    Out[r*Stride+h] += d[i]*d[j];
+            for(int i=0; i<K; i++, r++)
+                Out[r*Stride+h] += d[i]*g;
+            Out[r*Stride+h] += g;
+        }
     }
-    return sum;
 }
 
-void LogOddsModel::initialize(MetaMinimac *const ThisStudy)
+template<int K>
+void LogOddsModel<K>::reinitialize(int HapInBatch, MetaMinimac *const ThisStudy)
 {
-    NoStudies=ThisStudy->NoInPrefix;
-    NoMarkers=400;
-    NoCommonVariants = ThisStudy->NoCommonTypedVariants;
+    WeightTensor &Fit = ThisStudy->FitEquations;
+    const double *In = Fit.Site(0) + HapInBatch;
+    int Stride = Fit.HapStride;
+
+    int r = 0;
+    for(int i=0; i<K; i++)
+        for(int j=0; j<=i; j++, r++)
+            Gram[i][j] = Gram[j][i] = In[r*Stride];
+    for(int i=0; i<K; i++, r++)
+        Proj[i] = In[r*Stride];
+    GTSumSq = In[r*Stride];
 }
 
-void LogOddsModel::reinitialize(int SampleId, MetaMinimac *const ThisStudy)
+template<int K>
+void LogOddsModel<K>::minimize(double *Prob)
 {
-    NoStudies=ThisStudy->NoInPrefix;
-    NoMarkers=400;
-    NoCommonVariants = ThisStudy->NoCommonTypedVariants;
-
-    LooDosageVal.clear();
-    LooDosageVal.resize(NoStudies);
-    ChipGTVal.clear();
-    ChipGTVal.resize(NoMarkers);
-    SampleID=SampleId;
+    // The fit is the quadratic w'Gw - 2b'w (up to a constant) with the
+    // Gram matrix G and projection b of the LOO dosages. A tiny ridge makes
+    // G positive definite, so that flat directions resolve to the most
+    // even weights, as they do when the Simplex starts from equal weights.
+    double Ridged[K][K];
+    double Trace = 0.0;
+    for(int i=0; i<K; i++)
+    {
+        Trace += Gram[i][i];
+        for(int j=0; j<K; j++)
+            Ridged[i][j] = Gram[i][j];
+    }
+    for(int i=0; i<K; i++)
+        Ridged[i][i] += 1e-10*(Trace/K + 1.0);
 
-    for(int i=0; i<NoStudies; i++)
+    // Active-set search: the optimum is the best stationary point among the
+    // faces of the simplex whose solution is non-negative. With K <= 4
+    // there are at most 15 faces, each solved from its KKT system
+    //      [G_S 1; 1' 0] [w; mu] = [b_S; 1]
+    double Best = numeric_limits<double>::max();
+    for(int Subset=1; Subset < (1<<K); Subset++)
     {
-        LooDosageVal[i].resize(NoMarkers);
-        for(int j=0; j<NoMarkers; j++) {
-            LooDosageVal[i][j] = ThisStudy->InputData[i].LooDosage[SampleID][NoCommonVariants-j-1];
+        int Index[K], n = 0;
+        for(int i=0; i<K; i++)
+            if(Subset & (1<<i))
+                Index[n++] = i;
+
+        double System[K+1][K+2];
+        for(int i=0; i<n; i++)
+        {
+            for(int j=0; j<n; j++)
+                System[i][j] = Ridged[Index[i]][Index[j]];
+            System[i][n] = 1.0;
+            System[i][n+1] = Proj[Index[i]];
         }
-    }
+        for(int j=0; j<n; j++)
+            System[n][j] = 1.0;
+        System[n][n] = 0.0;
+        System[n][n+1] = 1.0;
 
+        for(int col=0; col<=n; col++)
+        {
+            int Pivot = col;
+            for(int row=col+1; row<=n; row++)
+                if(fabs(System[row][col]) > fabs(System[Pivot][col]))
+                    Pivot = row;
+            for(int j=0; j<=n+1; j++)
+                swap(System[col][j], System[Pivot][j]);
 
-    for(int j=0; j<NoMarkers; j++)
-    {
-        ChipGTVal[j]=ThisStudy->InputData[0].TypedGT[SampleID][NoCommonVariants-j-1];
+            for(int row=0; row<=n; row++)
+            {
+                if(row==col)
+                    continue;
+                double Factor = System[row][col]/System[col][col];
+                for(int j=col; j<=n+1; j++)
+                    System[row][j] -= Factor*System[col][j];
+            }
+        }
+
+        double w[K];
+        bool Feasible = true;
+        for(int i=0; i<n; i++)
+        {
+            w[i] = System[i][n+1]/System[i][i];
+            if(w[i] < 0.0)
+                Feasible = false;
+        }
+        if(!Feasible)
+            continue;
+
+        double Objective = 0.0;
+        for(int i=0; i<n; i++)
+        {
+            Objective -= 2.0*Proj[Index[i]]*w[i];
+            for(int j=0; j<n; j++)
+                Objective += w[i]*Ridged[Index[i]][Index[j]]*w[j];
+        }
+
+        if(Objective < Best)
+        {
+            Best = Objective;
+            for(int i=0; i<K; i++)
+                Prob[i] = 0.0;
+            for(int i=0; i<n; i++)
+                Prob[Index[i]] = w[i];
+        }
     }
 }
 
-
+template class LogOddsModel<2>;
+template class LogOddsModel<3>;
+template class LogOddsModel<4>;
@@ -35,21 +35,39 @@ using namespace std;
 //    void walkRight(int Sample, MetaMinimac *const ThisStudy, int SampleInBatch);
 //};
 
+// Least-squares fit of the LOO dosages at the last NoMarkers typed sites to
+// the typed genotypes. K is the number of studies, fixed at compile time so
+// that all loops over studies are fully unrolled.
+//
+// The fit only enters through its normal equations: the Gram matrix of the
+// dosages, their projection on the genotypes and the genotype sum of
+// squares. These are accumulated once per batch for all haplotypes in
+// ThisStudy->FitEquations, so that a model is set up by copying a handful
+// of values and every evaluation of the objective costs O(K^2).
+template<int K>
 class LogOddsModel
 {
 private:
 
-    int NoMarkers, NoCommonVariants;
-    int NoStudies;
-    int SampleID;
-    vector<vector<double> > LooDosageVal;
-    vector<double> ChipGTVal;
-
+    double Gram[K][K], Proj[K];
+    double GTSumSq;
 
 public:
-    void initialize(MetaMinimac *const ThisStudy);
-    void reinitialize(int SampleId, MetaMinimac *const ThisStudy);
-    double  operator()(vector<double> x);
+    // Rows of FitEquations: the lower triangle of the Gram matrix, the
+    // projection and the genotype sum of squares.
+    enum { NoRows = K*(K+1)/2 + K + 1 };
+
+    // Accumulates the normal equations of haplotypes [HapStart,HapEnd),
+    // vectorized over haplotypes straight from the packed typed data.
+    static void accumulate(MetaMinimac *const ThisStudy, int HapStart, int HapEnd);
+
+    void reinitialize(int HapInBatch, MetaMinimac *const ThisStudy);
+    double  operator()(const vector<double> &x);
+
+    // Minimizes the same least-squares fit directly over the probability
+    // simplex and writes the K weights to Prob. Used instead of running
+    // BT::Simplex on operator() unless --minimizer simplex is given.
+    void minimize(double *Prob);
 };
 
 
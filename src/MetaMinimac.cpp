@@ -3,8 +3,14 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
 #include "simplex.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #define RECOM_MIN 1e-04
+#define ZERO_RUN_SAMPLES 64
 
 using BT::Simplex;
 
@@ -85,7 +91,7 @@ bool MetaMinimac::ParseInputVCFFiles()
         cout<<" Program aborting ... "<<endl<<endl;
         return false;
     }
-    if(NoInPrefix>4)
+    if(NoInPrefix>MAXSTUDIES)
     {
         cout<<"\n ERROR ! Must have less than 5 studies for meta-imputation to work !!! "<<endl;
         cout<<" Program aborting ... "<<endl<<endl;
@@ -100,6 +106,7 @@ bool MetaMinimac::CheckSampleNameCompatibility()
     cout<<"\n Checking Sample Compatibility across files ... "<<endl;
     for(int i=0;i<NoInPrefix;i++)
     {
+        InputData[i].NoReadThreads = myUserVariables.cpus;
         if(!InputData[i].LoadSampleNames(InPrefixList[i].c_str()))
             return false;
         if(i>0)
@@ -122,23 +129,22 @@ bool MetaMinimac::CheckSampleNameCompatibility()
 }
 
 
-void MetaMinimac::OpenStreamInputDosageFiles(bool siteOnly)
+void MetaMinimac::OpenStreamInputDosageFiles()
 {
     InputDosageStream.resize(NoInPrefix);
-    CurrentRecordFromStudy.resize(NoInPrefix);
+    CurrentBpFromStudy.resize(NoInPrefix);
+    CurrentVariantKeyFromStudy.resize(NoInPrefix);
     StudiesHasVariant.resize(NoInPrefix);
     for(int i=0; i<NoInPrefix;i++)
     {
-        VcfHeader header;
-        InputDosageStream[i] = new VcfFileReader();
-        CurrentRecordFromStudy[i]= new VcfRecord();
-        InputDosageStream[i]->open( (GetDosageFileFullName(InPrefixList[i])).c_str() , header);
-        InputDosageStream[i]->setSiteOnly(siteOnly);
-        InputDosageStream[i]->readRecord(*CurrentRecordFromStudy[i]);
+        InputDosageStream[i] = new VcfRecordReader();
+        InputDosageStream[i]->Open( (GetDosageFileFullName(InPrefixList[i])).c_str(), myUserVariables.cpus );
+        InputDosageStream[i]->SetSampleRange(StartSamId, EndSamId);
+        ReadCurrentRecord(i);
         InputData[i].noMarkers = 0;
         InputData[i].noTypedMarkers = 0;
     }
-    finChromosome = CurrentRecordFromStudy[0]->getChromStr();
+    finChromosome = InputDosageStream[0]->GetChromStr();
 }
 
 void MetaMinimac::CloseStreamInputDosageFiles()
@@ -146,7 +152,6 @@ void MetaMinimac::CloseStreamInputDosageFiles()
     for (int i = 0; i < NoInPrefix; i++)
     {
         delete InputDosageStream[i];
-        delete CurrentRecordFromStudy[i];
     }
 }
 
@@ -154,6 +159,7 @@ bool MetaMinimac::OpenStreamOutputDosageFiles()
 {
     vcfdosepartial = ifopen(myUserVariables.outfile + ".metaDose.vcf"+(myUserVariables.gzip ? ".gz" : ""), "wb", myUserVariables.gzip ? InputFile::BGZF : InputFile::UNCOMPRESSED);
     VcfPrintStringPointer = (char*)malloc(sizeof(char) * (myUserVariables.PrintBuffer));
+    CreateZeroSampleRuns();
     if(vcfdosepartial==NULL)
     {
         cout <<"\n\n ERROR !!! \n Could NOT create the following file : "<< myUserVariables.outfile + ".metaDose.vcf"+(myUserVariables.gzip ? ".gz" : "") <<endl;
@@ -263,13 +269,10 @@ bool MetaMinimac::LoadEmpVariantInfo()
 {
     cout<<"\n Scanning input empirical VCFs for commonly typed SNPs ... "<<endl;
     int time_start = time(0);
+    FindCommonGenotypedVariants();
     for(int i=0;i<NoInPrefix;i++)
-    {
-        InputData[i].LoadEmpVariantList();
         cout<<" -- Study "<<i+1<<" #Genotyped Sites = "<<InputData[i].noTypedMarkers<<endl;
-    }
     finChromosome = InputData[0].finChromosome;
-    FindCommonGenotypedVariants();
 
     cout<<" -- Found " << NoCommonTypedVariants <<" commonly genotyped! "<<endl;
     cout<<" -- Successful (" << (time(0)-time_start) << " seconds) !!!" << endl;
@@ -277,31 +280,81 @@ bool MetaMinimac::LoadEmpVariantInfo()
 
 }
 
-void MetaMinimac::FindCommonGenotypedVariants()
+void MetaMinimac::ReadEmpVariant(int Study, variant &ThisVariant)
 {
-    std::map<string, int > HashUnionVariantMap;
+    if(!InputData[Study].ReadEmpVariant(ThisVariant))
+        ThisVariant.bp = MAXBP;
+}
 
-    for(int i=1;i<NoInPrefix;i++)
+void MetaMinimac::FindCommonGenotypedVariants()
+{
+    // The empiricalDose files are sorted by position, so the common typed
+    // sites are found by a merge join over all studies that only holds the
+    // records of each study at the current position. Sites are kept in the
+    // order of the first study.
+    vector<variant> EmpVariant(NoInPrefix);
+    vector<vector<variant> > VariantsAtBp(NoInPrefix);
+    for(int i=0;i<NoInPrefix;i++)
     {
-        for(int j=0;j<InputData[i].noTypedMarkers;j++)
-        {
-            variant *thisVariant=&InputData[i].TypedVariantList[j];
-            HashUnionVariantMap[thisVariant->name]++;
-        }
+        InputData[i].OpenEmpVariantStream();
+        ReadEmpVariant(i, EmpVariant[i]);
     }
 
     TransitionProb.clear();
     int lastbp = 0;
-    for(int j=0; j<InputData[0].noTypedMarkers; j++)
+    while(true)
     {
-        variant *thisVariant = &InputData[0].TypedVariantList[j];
-        if(HashUnionVariantMap[thisVariant->name]==NoInPrefix-1)
+        int TargetBp = 0;
+        for(int i=0;i<NoInPrefix;i++)
+            TargetBp = max(TargetBp, EmpVariant[i].bp);
+        if(TargetBp == MAXBP)
+            break;
+
+        bool Aligned = true;
+        for(int i=0;i<NoInPrefix;i++)
+        {
+            while(EmpVariant[i].bp < TargetBp)
+                ReadEmpVariant(i, EmpVariant[i]);
+            if(EmpVariant[i].bp != TargetBp)
+                Aligned = false;
+        }
+        if(!Aligned)
+            continue;
+
+        for(int i=0;i<NoInPrefix;i++)
+        {
+            VariantsAtBp[i].clear();
+            while(EmpVariant[i].bp == TargetBp)
+            {
+                VariantsAtBp[i].push_back(EmpVariant[i]);
+                ReadEmpVariant(i, EmpVariant[i]);
+            }
+        }
+
+        for(int j=0; j<(int)VariantsAtBp[0].size(); j++)
         {
-            CommonGenotypeVariantNameList.push_back(thisVariant->name);
+            variant *thisVariant = &VariantsAtBp[0][j];
+            bool Common = true;
+            for(int i=1; i<NoInPrefix && Common; i++)
+            {
+                Common = false;
+                for(int k=0; k<(int)VariantsAtBp[i].size(); k++)
+                {
+                    variant &Other = VariantsAtBp[i][k];
+                    if(Other.key == thisVariant->key
+                       && SameVariant(Other.key, Other.bp, Other.refAlleleString.c_str(), Other.altAlleleString.c_str(),
+                                      thisVariant->bp, thisVariant->refAlleleString.c_str(), thisVariant->altAlleleString.c_str()))
+                        Common = true;
+                }
+            }
+            if(!Common)
+                continue;
+
             variant tempVariant;
             tempVariant.chr=thisVariant->chr;
             tempVariant.bp=thisVariant->bp;
-            tempVariant.name=thisVariant->name;
+            tempVariant.key=thisVariant->key;
+            tempVariant.name=thisVariant->chr+":"+to_string(thisVariant->bp)+":"+thisVariant->refAlleleString+":"+thisVariant->altAlleleString;
             tempVariant.altAlleleString = thisVariant->altAlleleString;
             tempVariant.refAlleleString = thisVariant->refAlleleString;
             CommonTypedVariantList.push_back(tempVariant);
@@ -312,97 +365,93 @@ void MetaMinimac::FindCommonGenotypedVariants()
         }
     }
 
-    NoCommonTypedVariants = CommonGenotypeVariantNameList.size();
+    NoCommonTypedVariants = CommonTypedVariantList.size();
 
+    // Finish the remaining records for the per-study counts.
+    variant tempVariant;
     for(int i=0;i<NoInPrefix;i++)
     {
-        InputData[i].ClearEmpVariantList();
+        while(InputData[i].ReadEmpVariant(tempVariant));
+        InputData[i].CloseEmpVariantStream();
     }
 }
 
 
-void MetaMinimac::FindCurrentMinimumPosition() {
-
-    if (NoInPrefix == 2) {
-        int a = CurrentRecordFromStudy[0]->get1BasedPosition();
-        int b = CurrentRecordFromStudy[1]->get1BasedPosition();
-        CurrentFirstVariantBp = a;
-        NoStudiesHasVariant = 1;
-        StudiesHasVariant[0] = 0;
-
-        if (b == a) {
-            if (IsVariantEqual(*CurrentRecordFromStudy[0], *CurrentRecordFromStudy[1]) == 1) {
-                NoStudiesHasVariant = 2;
-                StudiesHasVariant[1] = 1;
-            }
-        } else if (b < a) {
-            StudiesHasVariant[0] = 1;
-            CurrentFirstVariantBp = b;
+void MetaMinimac::FindCurrentMinimumPosition()
+{
+    // One pass over the cached keys of the current records. The first
+    // study at the smallest position fixes the variant, and every later
+    // study with the same key shares it, once SameVariant rules out a
+    // collision of hashed keys.
+    CurrentFirstVariantBp = CurrentBpFromStudy[0];
+    unsigned long long MinVariantKey = CurrentVariantKeyFromStudy[0];
+    VcfRecordReader *MinRecord = InputDosageStream[0];
+    StudiesHasVariant[0] = 0;
+    NoStudiesHasVariant = 1;
+
+    for(int i=1; i<NoInPrefix; i++)
+    {
+        if(CurrentBpFromStudy[i] < CurrentFirstVariantBp)
+        {
+            CurrentFirstVariantBp = CurrentBpFromStudy[i];
+            MinVariantKey = CurrentVariantKeyFromStudy[i];
+            MinRecord = InputDosageStream[i];
+            StudiesHasVariant[0] = i;
+            NoStudiesHasVariant = 1;
         }
-
+        else if(CurrentVariantKeyFromStudy[i] == MinVariantKey
+                && SameVariant(MinVariantKey, CurrentBpFromStudy[i], InputDosageStream[i]->GetRefStr(), InputDosageStream[i]->GetAltStr(),
+                               CurrentFirstVariantBp, MinRecord->GetRefStr(), MinRecord->GetAltStr()))
+            StudiesHasVariant[NoStudiesHasVariant++] = i;
     }
+}
 
-    else
+void MetaMinimac::ReadCurrentRecord(int Study)
+{
+    VcfRecordReader *Record = InputDosageStream[Study];
+    if(!Record->ReadRecord())
     {
-
-        CurrentFirstVariantBp=CurrentRecordFromStudy[0]->get1BasedPosition();
-
-        for(int i=1;i<NoInPrefix;i++)
-            if(CurrentRecordFromStudy[i]->get1BasedPosition() < CurrentFirstVariantBp)
-                CurrentFirstVariantBp=CurrentRecordFromStudy[i]->get1BasedPosition();
-
-        NoStudiesHasVariant=0;
-        VcfRecord *minRecord;
-        minRecord = new VcfRecord();
-        int Begin=0;
-        for(int i=0;i<NoInPrefix;i++)
-        {
-            if(CurrentRecordFromStudy[i]->get1BasedPosition() == CurrentFirstVariantBp)
-            {
-                if(Begin==0)
-                {
-                    Begin=1;
-                    minRecord=CurrentRecordFromStudy[i];
-                    StudiesHasVariant[NoStudiesHasVariant] = i;
-                    NoStudiesHasVariant++;
-                }
-                else if (IsVariantEqual(*minRecord, *CurrentRecordFromStudy[i])==1)
-                {
-                    StudiesHasVariant[NoStudiesHasVariant] = i;
-                    NoStudiesHasVariant++;
-                }
-            }
-        }
+        CurrentBpFromStudy[Study] = MAXBP;
+        CurrentVariantKeyFromStudy[Study] = 0;
+        return;
     }
+    CurrentBpFromStudy[Study] = Record->Get1BasedPosition();
+    CurrentVariantKeyFromStudy[Study] = GetVariantKey(CurrentBpFromStudy[Study], Record->GetRefStr(), Record->GetAltStr());
 }
 
-int MetaMinimac::IsVariantEqual(VcfRecord &Rec1, VcfRecord &Rec2)
+void MetaMinimac::UpdateCurrentRecords()
 {
-    if(strcmp(Rec1.getRefStr(),Rec2.getRefStr())!=0)
-        return 0;
-    if(strcmp(Rec1.getAltStr(),Rec2.getAltStr())!=0)
-        return 0;
-    return 1;
+    for(int i=0; i<NoStudiesHasVariant;i++)
+        ReadCurrentRecord(StudiesHasVariant[i]);
 }
 
 
-
-void MetaMinimac::UpdateCurrentRecords()
+void MetaMinimac::CreatePloidyRuns()
 {
-    for(int i=0; i<NoStudiesHasVariant;i++)
-    {
-        int index = StudiesHasVariant[i];
-        if(!InputDosageStream[index]->readRecord(*CurrentRecordFromStudy[index]))
-            CurrentRecordFromStudy[index]->set1BasedPosition(MAXBP);
+    // Haplotypes of a batch are stored densely, so only the writers need
+    // to know which of them pair up into diploid samples.
+    NoHapsThisBatch = 0;
+    PloidyRuns.clear();
+    for(int SampleId=StartSamId; SampleId<EndSamId; SampleId++)
+    {
+        int Ploidy = InputData[0].SampleNoHaplotypes[SampleId];
+        if(PloidyRuns.empty() || PloidyRuns.back().Ploidy != Ploidy)
+        {
+            PloidyRun NewRun;
+            NewRun.Ploidy = Ploidy;
+            NewRun.NoSamples = 0;
+            PloidyRuns.push_back(NewRun);
+        }
+        PloidyRuns.back().NoSamples++;
+        NoHapsThisBatch += Ploidy;
     }
 }
 
-
 void MetaMinimac::LoadLooDosage()
 {
     printf(" -- Loading Empirical Dosage Data ...\n");
     for(int i=0; i<NoInPrefix; i++)
-        InputData[i].ReadBasedOnSortCommonGenotypeList(CommonGenotypeVariantNameList, StartSamId, EndSamId);
+        InputData[i].ReadBasedOnSortCommonGenotypeList(CommonTypedVariantList, StartSamId, EndSamId);
 }
 
 String MetaMinimac::PerformFinalAnalysis()
@@ -415,6 +464,19 @@ String MetaMinimac::PerformFinalAnalysis()
 
     int maxVcfSample = myUserVariables.VcfBuffer;
 
+#ifdef _OPENMP
+    omp_set_num_threads(myUserVariables.cpus);
+#else
+    if(myUserVariables.cpus > 1)
+        cout << " WARNING !!! Binary was built without OpenMP, --threads is ignored ..." << endl;
+    myUserVariables.cpus = 1;
+#endif
+
+    InitializeKernels();
+    cout << " Forward/backward kernels : " << Kernels.Name << endl;
+    cout << " Weight storage           : " << CompactPosterior.Name << endl;
+    cout << " Initial weight minimizer : " << myUserVariables.minimizer << endl;
+
     StartSamId = 0;
 
     batchNo = 0;
@@ -429,6 +491,8 @@ String MetaMinimac::PerformFinalAnalysis()
 
         start_time = time(0);
 
+        CreatePloidyRuns();
+
         // Read Data From empiricalDose
         LoadLooDosage();
 
@@ -461,208 +525,242 @@ String MetaMinimac::PerformFinalAnalysis()
 }
 
 
+template<int K>
+void MetaMinimac::SelectKernels()
+{
+    if(myUserVariables.minimizer == "simplex")
+        InitiateLeftProbKernel = &MetaMinimac::InitiateLeftProbs<K,false>;
+    else
+        InitiateLeftProbKernel = &MetaMinimac::InitiateLeftProbs<K,true>;
+    PrintWeightForHaplotypeKernel = &MetaMinimac::PrintWeightForHaplotype<K>;
+}
+
+void MetaMinimac::InitializeKernels()
+{
+    Kernels.Initialize(NoInPrefix);
+
+    if(myUserVariables.precision == "float")
+        CompactPosterior.Initialize(FLOAT_WEIGHTS);
+    else if(myUserVariables.precision == "half")
+        CompactPosterior.Initialize(HALF_WEIGHTS);
+    else
+        CompactPosterior.Initialize(DOUBLE_WEIGHTS);
+
+    switch(NoInPrefix)
+    {
+        case 2: SelectKernels<2>(); break;
+        case 3: SelectKernels<3>(); break;
+        case 4: SelectKernels<4>(); break;
+        default: abort();
+    }
+}
+
 void MetaMinimac::CalculateWeights()
 {
     cout << " -- Calculating Weights ... " << endl;
     InitiateWeights();
     CalculateLeftProbs();
-    CalculatePosterior();
+
+    // Compact weights are stored for all sites up front, while double
+    // weights are formed segment by segment during the output pass.
+    if(CompactPosterior.Precision == DOUBLE_WEIGHTS)
+        CalculatePosterior(0);
+    else
+        for(int Segment=0; Segment<NoSegments; Segment++)
+            CalculatePosterior(Segment);
 }
 
 void MetaMinimac::InitiateWeights()
 {
-    int NoSamplesThisBatch = EndSamId-StartSamId;
-    Weights.clear();
-    Weights.resize(NoCommonTypedVariants);
-    for(int i=0; i<NoCommonTypedVariants; i++)
-    {
-        vector<vector<double> > &ThisWeights = Weights[i];
-        ThisWeights.resize(2*NoSamplesThisBatch);
-        for(int j=0; j<2*NoSamplesThisBatch; j++)
-            ThisWeights[j].resize(NoInPrefix);
+    // Left probabilities are kept at the last site of every segment only,
+    // and a segment is recomputed from its checkpoint when the output pass
+    // reaches it. Without --checkpoint the whole chromosome is one segment,
+    // unless the weights are kept in a compact store.
+    bool Compact = (CompactPosterior.Precision != DOUBLE_WEIGHTS);
+    if(myUserVariables.checkpoint || Compact)
+        SegmentLength = (int)ceil(sqrt((double)NoCommonTypedVariants));
+    else
+        SegmentLength = NoCommonTypedVariants;
+    NoSegments = (NoCommonTypedVariants + SegmentLength - 1)/SegmentLength;
+
+    Weights.Resize(SegmentLength, NoInPrefix, NoHapsThisBatch);
+    Checkpoints.Resize(NoSegments, NoInPrefix, NoHapsThisBatch);
+    BoundaryWeights.Resize(1, NoInPrefix, NoHapsThisBatch);
+    PrevRightProb.Resize(1, NoInPrefix, NoHapsThisBatch);
+    PrevRightProb.Fill(1.0);
+    WeightSlopes.Resize(1, NoInPrefix, NoHapsThisBatch);
+    SubsetWeightSums.Resize(1<<NoInPrefix, 2, NoHapsThisBatch);
+    SubsetSumsReady.assign(1<<NoInPrefix, false);
+    InterpolationInterval = -1;
+    FitEquations.Resize(1, NoInPrefix*(NoInPrefix+1)/2 + NoInPrefix + 1, NoHapsThisBatch);
+    if(Compact)
+    {
+        CompactPosterior.Resize(NoCommonTypedVariants, NoInPrefix, NoHapsThisBatch);
+        ExpandedWeights.Resize(2, NoInPrefix, NoHapsThisBatch);
     }
 }
 
-void MetaMinimac::CalculateLeftProbs()
+void MetaMinimac::GetHaplotypeBlock(int Block, int NoBlocks, int &HapStart, int &HapEnd)
 {
-    int NoSamplesThisBatch = EndSamId-StartSamId;
-    for (int id=0; id<NoSamplesThisBatch; id++)
-    {
-        int SampleId = StartSamId + id;
-        if (InputData[0].SampleNoHaplotypes[SampleId] == 2)
-        {
-            InitiateLeftProb(2*id);
-            InitiateLeftProb(2*id+1);
-        }
-        else
-            InitiateLeftProb(2*id);
-    }
-
-    NoCommonVariantsProcessed = 1;
-    while(NoCommonVariantsProcessed < NoCommonTypedVariants)
-    {
-        Recom = TransitionProb[NoCommonTypedVariants-NoCommonVariantsProcessed];
-        NoCommonVariantsProcessed++;
-        for (int id=0; id<NoSamplesThisBatch; id++)
-        {
-            int SampleId = StartSamId + id;
-            if (InputData[0].SampleNoHaplotypes[SampleId] == 2)
-            {
-                UpdateOneStepLeft(2*id);
-                UpdateOneStepLeft(2*id+1);
-            }
-            else
-                UpdateOneStepLeft(2*id);
-        }
-    }
-
+    // Blocks start on a multiple of 8 haplotypes so that every thread
+    // works on whole SIMD vectors of its own.
+    HapStart = (int)((long)NoHapsThisBatch*Block/NoBlocks)/8*8;
+    HapEnd = (Block+1==NoBlocks) ? NoHapsThisBatch : (int)((long)NoHapsThisBatch*(Block+1)/NoBlocks)/8*8;
 }
 
-void MetaMinimac::InitiateLeftProb(int HapInBatch)
+void MetaMinimac::GetSegment(int Segment, int &First, int &Last)
 {
-    LogOddsModel ThisSampleAnalysis;
-    ThisSampleAnalysis.reinitialize(HapInBatch, this);
-    vector<double> init(NoInPrefix-1, 0.0);
-    vector<double> MiniMizer = Simplex(ThisSampleAnalysis, init);
-
-    vector<double> InitProb;
-    InitProb.resize(NoInPrefix);
-    logitTransform(MiniMizer, InitProb);
-
-    float ThisGT = InputData[0].TypedGT[HapInBatch][NoCommonTypedVariants-1];
-    vector<double> &ThisWeights = Weights[NoCommonTypedVariants-1][HapInBatch];
+    First = Segment*SegmentLength;
+    Last = min(First+SegmentLength, NoCommonTypedVariants)-1;
+}
 
+void MetaMinimac::GetStep(int TypedId, int HapStart, double Recom, HMMSiteData &Site, HMMStepParameters &Param)
+{
     for(int i=0; i<NoInPrefix; i++)
-    {
-        InitProb[i]+=backgroundError;
-        float ThisLooDosage = InputData[i].LooDosage[HapInBatch][NoCommonTypedVariants-1];
-        InitProb[i] *= (ThisGT==1)?(ThisLooDosage+backgroundError):(1-ThisLooDosage+backgroundError);
-        ThisWeights[i] = InitProb[i];
-    }
+        Site.Dosage[i] = InputData[i].TypedData.Dosage(TypedId) + HapStart;
+    Site.GT = InputData[0].TypedData.GT(TypedId) + HapStart/8;
+
+    Param.r = Recom*1.0/NoInPrefix;
+    Param.complement = 1-Recom;
+    Param.Offset[1] = backgroundError;
+    Param.Slope[1] = 1.0/LOO_DOSAGE_SCALE;
+    Param.Offset[0] = 1+backgroundError;
+    Param.Slope[0] = -1.0/LOO_DOSAGE_SCALE;
 }
 
-void MetaMinimac::UpdateOneStepLeft(int HapInBatch)
+void MetaMinimac::CalculateLeftProbs()
 {
-    double r = Recom*1.0/NoInPrefix, complement = 1-Recom;
-    float ThisGT = InputData[0].TypedGT[HapInBatch][NoCommonTypedVariants-NoCommonVariantsProcessed];
-    vector<double> &ThisLeftProb = Weights[NoCommonTypedVariants-NoCommonVariantsProcessed][HapInBatch];
-    vector<double> &ThisPrevLeftProb = Weights[NoCommonTypedVariants-NoCommonVariantsProcessed+1][HapInBatch];
+    // Each haplotype is an independent chain, so every thread walks
+    // its own block of haplotypes through all typed sites. Segments are
+    // swept from the right end, leaving a checkpoint at the last site of
+    // the segment before.
+    int NoBlocks = max(1, min(myUserVariables.cpus, NoHapsThisBatch/8));
 
-    double sum = 0.0;
-    for(int i=0; i<NoInPrefix; i++)
+    #pragma omp parallel for schedule(static,1)
+    for (int block=0; block<NoBlocks; block++)
     {
-        for(int j=0; j<NoInPrefix; j++)
-            ThisLeftProb[i] += ThisPrevLeftProb[j]*r;
-        ThisLeftProb[i] += ThisPrevLeftProb[i]*complement;
-
-        float ThisLooDosage = InputData[i].LooDosage[HapInBatch][NoCommonTypedVariants-NoCommonVariantsProcessed];
-        ThisLeftProb[i] *= (ThisGT==1)?(ThisLooDosage+backgroundError):(1-ThisLooDosage+backgroundError);
-        sum += ThisLeftProb[i];
+        int HapStart, HapEnd;
+        GetHaplotypeBlock(block, NoBlocks, HapStart, HapEnd);
+        (this->*InitiateLeftProbKernel)(HapStart, HapEnd);
     }
 
-
-    while(sum < JumpThreshold)
+    for (int Segment=NoSegments-1; Segment>0; Segment--)
     {
-        sum = 0.0;
-        for(int i=0; i<NoInPrefix; i++)
+        int First, Last;
+        GetSegment(Segment, First, Last);
+
+        #pragma omp parallel for schedule(static,1)
+        for (int block=0; block<NoBlocks; block++)
         {
-            ThisLeftProb[i] *= JumpFix;
-            sum += ThisLeftProb[i];
+            int HapStart, HapEnd;
+            GetHaplotypeBlock(block, NoBlocks, HapStart, HapEnd);
+            CalculateSegmentLeftProbs(HapStart, HapEnd, Segment);
+            UpdateOneStepLeft(HapStart, HapEnd, First-1, Weights.Site(0), Checkpoints.Site(Segment-1));
         }
     }
 
 }
 
-void MetaMinimac::CalculatePosterior()
+template<int K, bool ActiveSet>
+void MetaMinimac::InitiateLeftProbs(int HapStart, int HapEnd)
 {
-    int NoSamplesThisBatch = EndSamId-StartSamId;
-    PrevRightProb.clear();
-    PrevRightProb.resize(2*NoSamplesThisBatch);
-    for (int id=0; id<NoSamplesThisBatch; id++)
+    LogOddsModel<K>::accumulate(this, HapStart, HapEnd);
+
+    double *ThisWeights = Checkpoints.Site(NoSegments-1);
+    int Stride = Checkpoints.HapStride;
+
+    for(int HapInBatch=HapStart; HapInBatch<HapEnd; HapInBatch++)
     {
-        int SampleId = StartSamId + id;
-        if (InputData[0].SampleNoHaplotypes[SampleId] == 2)
+        LogOddsModel<K> ThisSampleAnalysis;
+        ThisSampleAnalysis.reinitialize(HapInBatch, this);
+
+        double InitProb[K];
+        if(ActiveSet)
+            ThisSampleAnalysis.minimize(InitProb);
+        else
         {
-            InitiateRightProb(2*id);
-            InitiateRightProb(2*id+1);
+            vector<double> init(K-1, 0.0);
+            vector<double> MiniMizer = Simplex(ThisSampleAnalysis, init);
+            logitTransform<K>(&MiniMizer[0], InitProb);
         }
-        else
-            InitiateRightProb(2*id);
-    }
 
-    NoCommonVariantsProcessed = 1;
-    while(NoCommonVariantsProcessed < NoCommonTypedVariants)
-    {
-        Recom = TransitionProb[NoCommonVariantsProcessed];
-        for (int id=0; id<NoSamplesThisBatch; id++)
+        int ThisGT = InputData[0].TypedData.GetGT(NoCommonTypedVariants-1, HapInBatch);
+
+        double sum = 0.0;
+        for(int i=0; i<K; i++)
         {
-            int SampleId = StartSamId + id;
-            if (InputData[0].SampleNoHaplotypes[SampleId] == 2)
-            {
-                UpdateOneStepRight(2*id);
-                UpdateOneStepRight(2*id+1);
-            }
-            else
-                UpdateOneStepRight(2*id);
+            InitProb[i]+=backgroundError;
+            float ThisLooDosage = InputData[i].TypedData.GetDosage(NoCommonTypedVariants-1, HapInBatch);
+            InitProb[i] *= (ThisGT==1)?(ThisLooDosage+backgroundError):(1-ThisLooDosage+backgroundError);
+            sum += InitProb[i];
         }
-        NoCommonVariantsProcessed++;
-    }
 
+        for(int i=0; i<K; i++)
+            ThisWeights[i*Stride+HapInBatch] = InitProb[i]/sum;
+    }
 }
 
-void MetaMinimac::InitiateRightProb(int HapInBatch)
+void MetaMinimac::CalculateSegmentLeftProbs(int HapStart, int HapEnd, int Segment)
 {
-    PrevRightProb[HapInBatch].resize(NoInPrefix, 1.0);
+    int First, Last;
+    GetSegment(Segment, First, Last);
+
+    for(int i=0; i<NoInPrefix; i++)
+        memcpy(Weights.Row(Last-First, i) + HapStart, Checkpoints.Row(Segment, i) + HapStart, (HapEnd-HapStart)*sizeof(double));
+
+    for (int TypedId=Last-1; TypedId>=First; TypedId--)
+        UpdateOneStepLeft(HapStart, HapEnd, TypedId, Weights.Site(TypedId+1-First), Weights.Site(TypedId-First));
 }
 
+void MetaMinimac::UpdateOneStepLeft(int HapStart, int HapEnd, int TypedId, const double *PrevLeft, double *CurrLeft)
+{
+    HMMSiteData Site;
+    HMMStepParameters Param;
+    GetStep(TypedId, HapStart, TransitionProb[TypedId+1], Site, Param);
+
+    Kernels.LeftStep(PrevLeft + HapStart, CurrLeft + HapStart, Site, Weights.HapStride, HapEnd-HapStart, Param);
+}
 
-void MetaMinimac::UpdateOneStepRight(int HapInBatch)
+void MetaMinimac::CalculatePosterior(int Segment)
 {
+    // Segments are visited left to right, so the right probabilities
+    // simply carry over in PrevRightProb from one segment to the next.
+    int First, Last;
+    GetSegment(Segment, First, Last);
 
-    double r = Recom*1.0/NoInPrefix, complement = 1-Recom;
-    float ThisGT = InputData[0].TypedGT[HapInBatch][NoCommonVariantsProcessed-1];
-    vector<double> &ThisWeight = Weights[NoCommonVariantsProcessed][HapInBatch];
-    vector<double> &ThisPrevRightProb = PrevRightProb[HapInBatch];
-    vector<double> ThisRightProb;
-    ThisRightProb.resize(NoInPrefix, 0.0);
+    int NoBlocks = max(1, min(myUserVariables.cpus, NoHapsThisBatch/8));
 
-    for(int i=0; i<NoInPrefix; i++)
+    #pragma omp parallel for schedule(static,1)
+    for (int block=0; block<NoBlocks; block++)
     {
-        float ThisLooDosage = InputData[i].LooDosage[HapInBatch][NoCommonVariantsProcessed-1];
-        ThisPrevRightProb[i] *= (ThisGT==1)?(ThisLooDosage+backgroundError):(1-ThisLooDosage+backgroundError);
-    }
+        int HapStart, HapEnd;
+        GetHaplotypeBlock(block, NoBlocks, HapStart, HapEnd);
+        CalculateSegmentLeftProbs(HapStart, HapEnd, Segment);
 
-    double sum = 0.0;
-    for(int i=0; i<NoInPrefix; i++)
-    {
-        for(int j=0; j<NoInPrefix; j++)
-            ThisRightProb[i] += ThisPrevRightProb[j]*r;
-        ThisRightProb[i] += ThisPrevRightProb[i]*complement;
-        sum += ThisRightProb[i];
-    }
+        for (int TypedId=max(First, 1); TypedId<=Last; TypedId++)
+            UpdateOneStepRight(HapStart, HapEnd, TypedId, Weights.Site(TypedId-First));
 
-    while(sum < JumpThreshold)
-    {
-        sum = 0.0;
-        for(int i=0; i<NoInPrefix; i++)
-        {
-            ThisRightProb[i] *= JumpFix;
-            sum += ThisRightProb[i];
-        }
+        if(CompactPosterior.Precision != DOUBLE_WEIGHTS)
+            for (int TypedId=First; TypedId<=Last; TypedId++)
+                CompactPosterior.Store(TypedId, Weights.Site(TypedId-First), Weights.HapStride, HapStart, HapEnd);
     }
 
-    for(int i=0; i<NoInPrefix; i++)
-    {
-        ThisWeight[i] *= ThisRightProb[i];
-        ThisPrevRightProb[i] = ThisRightProb[i];
-    }
+}
+
+void MetaMinimac::UpdateOneStepRight(int HapStart, int HapEnd, int TypedId, double *CurrWeight)
+{
+    HMMSiteData Site;
+    HMMStepParameters Param;
+    GetStep(TypedId-1, HapStart, TransitionProb[TypedId], Site, Param);
+
+    Kernels.RightStep(PrevRightProb.Site(0) + HapStart, CurrWeight + HapStart, Site, Weights.HapStride, HapEnd-HapStart, Param);
 }
 
 void MetaMinimac::MetaImputeAndOutput()
 {
     printf(" -- Gathering Dosage Data and Saving Results ...\n");
 
-    OpenStreamInputDosageFiles(false);
+    OpenStreamInputDosageFiles();
 
     if(myUserVariables.VcfBuffer<NoSamples)
     {
@@ -685,7 +783,7 @@ void MetaMinimac::OutputPartialVcf()
     int NoRecordProcessed = 0;
 
     PrevBp = 0, CurrBp = CommonTypedVariantList[0].bp;
-    PrevWeights = &Weights[0], CurrWeights = &Weights[0];
+    CurrWeights = LoadPosterior(0), PrevWeights = CurrWeights;
 
     BufferBp = 0;
     BufferNoVariants = 0;
@@ -782,7 +880,7 @@ void MetaMinimac::OutputAllVcf()
     int NoRecordProcessed = 0;
 
     PrevBp = 0, CurrBp = CommonTypedVariantList[0].bp;
-    PrevWeights = &Weights[0], CurrWeights = &Weights[0];
+    CurrWeights = LoadPosterior(0), PrevWeights = CurrWeights;
 
     BufferBp = 0;
     BufferNoVariants = 0;
@@ -826,23 +924,6 @@ void MetaMinimac::OutputAllVcf()
     }
 }
 
-void logitTransform(vector<double> &From,vector<double> &To)
-{
-
-    double sum=1.0;
-    int NoDimensions = (int)To.size();
-    for(int i=0; i < (NoDimensions-1); i++) sum+=exp(From[i]);
-    for(int i=0; i < (NoDimensions-1); i++)  To[i]=exp(From[i])/sum;
-    To[NoDimensions-1]=1.0/sum;
-
-
-    double checkSum=0.0;
-    for(int i=0;i<To.size();i++)
-        checkSum+=To[i];
-    if(checkSum>1.0001)
-        abort();
-}
-
 void MetaMinimac::OpenTempOutputFiles()
 {
     stringstream ss;
@@ -885,42 +966,66 @@ void MetaMinimac::OpenTempOutputFiles()
 
 void MetaMinimac::ReadCurrentDosageData()
 {
-    VcfRecord* tempRecord = CurrentRecordFromStudy[StudiesHasVariant[0]];
-    variant tempVariant;
-    tempVariant.chr  = tempRecord->getChromStr();
-    tempVariant.bp   = tempRecord->get1BasedPosition();
-    tempVariant.refAlleleString = tempRecord->getRefStr();
-    tempVariant.altAlleleString = tempRecord->getAltStr();
-    tempVariant.name = tempVariant.chr+":"+to_string(tempVariant.bp)+":"+ tempVariant.refAlleleString+":"+tempVariant.altAlleleString;
+    // Studies reporting the same position with other alleles have other
+    // keys and get entries of their own.
+    VcfRecordReader* tempRecord = InputDosageStream[StudiesHasVariant[0]];
+    unsigned long long VariantKey = CurrentVariantKeyFromStudy[StudiesHasVariant[0]];
+
+    // Variants sharing a hashed key have entries of their own.
+    int VariantId = -1;
+    typedef unordered_multimap<unsigned long long, int>::iterator IndexIterator;
+    pair<IndexIterator, IndexIterator> Found = BufferVariantIndex.equal_range(VariantKey);
+    for(IndexIterator Entry = Found.first; Entry != Found.second && VariantId < 0; Entry++)
+    {
+        variant &Other = BufferVariantList[Entry->second];
+        if(SameVariant(VariantKey, Other.bp, Other.refAlleleString.c_str(), Other.altAlleleString.c_str(),
+                       tempRecord->Get1BasedPosition(), tempRecord->GetRefStr(), tempRecord->GetAltStr()))
+            VariantId = Entry->second;
+    }
 
-    int VariantId = 0;
-    for(vector<variant>::iterator thisVariant = BufferVariantList.begin(); thisVariant < BufferVariantList.end(); ++thisVariant)
+    if(VariantId >= 0)
     {
-        if(tempVariant.name == thisVariant->name)
+        variant *thisVariant = &BufferVariantList[VariantId];
+        int count = thisVariant->NoStudiesHasVariant;
+        for(int i=0; i<NoStudiesHasVariant; i++)
         {
-            int count = thisVariant->NoStudiesHasVariant;
-            for(int i=0; i<NoStudiesHasVariant; i++)
-            {
-                thisVariant->StudiesHasVariant[count]=StudiesHasVariant[i];
-                count++;
-            }
-            thisVariant->NoStudiesHasVariant = count;
-            break;
+            // A study repeating a record only replaces its earlier data.
+            int index = StudiesHasVariant[i];
+            if(find(thisVariant->StudiesHasVariant.begin(), thisVariant->StudiesHasVariant.begin()+count, index)
+               == thisVariant->StudiesHasVariant.begin()+count)
+                thisVariant->StudiesHasVariant[count++] = index;
         }
-        VariantId++;
+        thisVariant->NoStudiesHasVariant = count;
     }
-    if(VariantId==BufferNoVariants)
+    else
     {
+        VariantId = BufferNoVariants;
+        BufferVariantIndex.insert(make_pair(VariantKey, VariantId));
+
+        // Entries are reused across buffer flushes, so their strings and
+        // study lists keep their capacity.
+        if(BufferNoVariants == (int)BufferVariantList.size())
+            BufferVariantList.push_back(variant());
+        variant &tempVariant = BufferVariantList[BufferNoVariants];
+        char bpString[16];
+        sprintf(bpString, "%d", tempRecord->Get1BasedPosition());
+
+        tempVariant.key  = VariantKey;
+        tempVariant.chr  = tempRecord->GetChromStr();
+        tempVariant.bp   = tempRecord->Get1BasedPosition();
+        tempVariant.refAlleleString = tempRecord->GetRefStr();
+        tempVariant.altAlleleString = tempRecord->GetAltStr();
+        tempVariant.name = tempVariant.chr;
+        tempVariant.name.append(":").append(bpString).append(":").append(tempVariant.refAlleleString).append(":").append(tempVariant.altAlleleString);
         tempVariant.NoStudiesHasVariant = NoStudiesHasVariant;
-        tempVariant.StudiesHasVariant = StudiesHasVariant;
-        BufferVariantList.push_back(tempVariant);
+        tempVariant.StudiesHasVariant.assign(StudiesHasVariant.begin(), StudiesHasVariant.end());
         BufferNoVariants++;
     }
 
     for(int j=0; j<NoStudiesHasVariant; j++)
     {
         int index = StudiesHasVariant[j];
-        InputData[index].LoadData(VariantId,CurrentRecordFromStudy[index]->getGenotypeInfo(), StartSamId, EndSamId);
+        InputData[index].LoadData(VariantId, *InputDosageStream[index], StartSamId, EndSamId);
     }
 }
 
@@ -963,38 +1068,50 @@ void MetaMinimac::CreateMetaImputedData(int VariantId)
 {
     CurrentHapDosageSum = 0;
     CurrentHapDosageSumSq = 0;
-    CurrentMetaImputedDosage.clear();
+    CurrentSparse = FindNonZeroHaplotypes(VariantId);
     if(CurrentVariant->NoStudiesHasVariant==1)
     {
-        CurrentMetaImputedDosage=InputData[CurrentVariant->StudiesHasVariant[0]].BufferHapDosage[0];
-        for(int i=0; i<2*(EndSamId-StartSamId); i++)
+        // The meta-imputed dosages of a variant from a single study are its
+        // input dosages, so they are printed from the buffer as they are.
+        CurrentHapDosage = InputData[CurrentVariant->StudiesHasVariant[0]].GetData(VariantId);
+        int NoHaps = CurrentSparse ? CurrentNonZeroHaps.size() : NoHapsThisBatch;
+        for(int i=0; i<NoHaps; i++)
         {
-            CurrentHapDosageSum += CurrentMetaImputedDosage[i];
-            CurrentHapDosageSumSq += CurrentMetaImputedDosage[i]*CurrentMetaImputedDosage[i];
+            double Dosage = CurrentHapDosage[CurrentSparse ? CurrentNonZeroHaps[i] : i];
+            CurrentHapDosageSum += Dosage;
+            CurrentHapDosageSumSq += Dosage*Dosage;
         }
+        return;
     }
+
+    if(CurrentSparse)
+        CurrentMetaImputedDosage.assign(NoHapsThisBatch, 0.0f);
     else
+        CurrentMetaImputedDosage.resize(NoHapsThisBatch);
+    MetaImpute(VariantId);
+    CurrentHapDosage = CurrentMetaImputedDosage.data();
+}
+
+bool MetaMinimac::FindNonZeroHaplotypes(int VariantId)
+{
+    // A variant is rare if it is zero on all but a few haplotypes in every
+    // study carrying it. Its meta-imputed dosage is then zero outside the
+    // union of those, so only the union is imputed and printed.
+    CurrentNonZeroHaps.clear();
+    for(int j=0; j<CurrentVariant->NoStudiesHasVariant; j++)
+    {
+        const int *Haps;
+        int NoHaps = InputData[CurrentVariant->StudiesHasVariant[j]].GetNonZeroHaps(VariantId, Haps);
+        if(NoHaps < 0)
+            return false;
+        CurrentNonZeroHaps.insert(CurrentNonZeroHaps.end(), Haps, Haps+NoHaps);
+    }
+    if(CurrentVariant->NoStudiesHasVariant > 1)
     {
-        CurrentMetaImputedDosage.resize(2*(EndSamId-StartSamId));
-        for (int j=0; j<CurrentVariant->NoStudiesHasVariant; j++)
-        {
-            int index = CurrentVariant->StudiesHasVariant[j];
-            InputData[index].GetData(VariantId);
-        }
-        for(int id=0; id<EndSamId-StartSamId; id++)
-        {
-            int SampleId = StartSamId+id;
-            if(InputData[0].SampleNoHaplotypes[SampleId]==2)
-            {
-                MetaImpute(2*id);
-                MetaImpute(2*id + 1);
-            }
-            else
-            {
-                MetaImpute(2*id);
-            }
-        }
+        sort(CurrentNonZeroHaps.begin(), CurrentNonZeroHaps.end());
+        CurrentNonZeroHaps.erase(unique(CurrentNonZeroHaps.begin(), CurrentNonZeroHaps.end()), CurrentNonZeroHaps.end());
     }
+    return true;
 }
 
 void MetaMinimac::UpdateWeights()
@@ -1004,7 +1121,7 @@ void MetaMinimac::UpdateWeights()
     PrevBp      = CurrBp;
     if(NoCommonVariantsProcessed < NoCommonTypedVariants)
     {
-        CurrWeights   = &Weights[NoCommonVariantsProcessed];
+        CurrWeights   = LoadPosterior(NoCommonVariantsProcessed);
         CurrBp        = CommonTypedVariantList[NoCommonVariantsProcessed].bp;
     }
     else
@@ -1013,37 +1130,139 @@ void MetaMinimac::UpdateWeights()
     }
 }
 
-void MetaMinimac::MetaImpute(int Sample)
+double* MetaMinimac::LoadPosterior(int TypedId)
+{
+    // Compact weights are widened into alternating slots, so that the
+    // previous site stays valid for interpolation.
+    if(CompactPosterior.Precision != DOUBLE_WEIGHTS)
+    {
+        double *ThisWeights = ExpandedWeights.Site(TypedId%2);
+        CompactPosterior.Load(TypedId, ThisWeights, ExpandedWeights.HapStride);
+        return ThisWeights;
+    }
+
+    if(TypedId > 0 && TypedId % SegmentLength == 0)
+    {
+        // The next segment overwrites the weights of this one, so keep
+        // the last of them for interpolating up to the boundary.
+        memcpy(BoundaryWeights.Site(0), PrevWeights, (size_t)NoInPrefix*Weights.HapStride*sizeof(double));
+        PrevWeights = BoundaryWeights.Site(0);
+        CalculatePosterior(TypedId/SegmentLength);
+    }
+    return Weights.Site(TypedId % SegmentLength);
+}
+
+void MetaMinimac::PrepareInterpolation()
+{
+    // Between two typed sites the weights are linear in the position,
+    //      Weight = PrevWeights + t * (CurrWeights-PrevWeights),
+    // so the slopes are formed once per interval and each variant only
+    // needs its fraction t of the way through the interval.
+    if(InterpolationInterval == NoCommonVariantsProcessed)
+        return;
+    InterpolationInterval = NoCommonVariantsProcessed;
+
+    int Stride = Weights.HapStride;
+    double *Slopes = WeightSlopes.Site(0);
+    for(int i=0; i<NoInPrefix*Stride; i++)
+        Slopes[i] = CurrWeights[i] - PrevWeights[i];
+    fill(SubsetSumsReady.begin(), SubsetSumsReady.end(), false);
+}
+
+const double* MetaMinimac::GetSubsetWeightSums(int Subset)
 {
-    vector<double>& ThisPrevWeights = (*PrevWeights)[Sample];
-    vector<double>& ThisCurrWeights = (*CurrWeights)[Sample];
+    // Sums over a subset of studies of PrevWeights and of the slopes, in
+    // two rows, for renormalizing over the studies carrying a variant.
+    double *Sums = SubsetWeightSums.Site(Subset);
+    if(SubsetSumsReady[Subset])
+        return Sums;
+    SubsetSumsReady[Subset] = true;
+
+    int Stride = Weights.HapStride;
+    double *PrevSum = Sums, *SlopeSum = Sums + Stride;
+    memset(Sums, 0, 2*Stride*sizeof(double));
+    for(int i=0; i<NoInPrefix; i++)
+    {
+        if(!(Subset & (1<<i)))
+            continue;
+        const double *ThisPrev = PrevWeights + i*Stride;
+        const double *ThisSlope = WeightSlopes.Row(0, i);
+        for(int hap=0; hap<NoHapsThisBatch; hap++)
+        {
+            PrevSum[hap] += ThisPrev[hap];
+            SlopeSum[hap] += ThisSlope[hap];
+        }
+    }
+    return Sums;
+}
 
-    double WeightSum = 0.0;
-    double Dosage = 0.0;
+void MetaMinimac::MetaImpute(int VariantId)
+{
+    PrepareInterpolation();
 
-    for (int j=0; j<CurrentVariant->NoStudiesHasVariant; j++)
+    HMMInterpolationData Data;
+    Data.t = (BufferBp-PrevBp)*1.0/(CurrBp-PrevBp);
+    int NoStudies = CurrentVariant->NoStudiesHasVariant;
+    int Subset = 0;
+    for (int j=0; j<NoStudies; j++)
     {
         int index = CurrentVariant->StudiesHasVariant[j];
-        double Weight = (ThisPrevWeights[index]*(CurrBp-BufferBp)+ThisCurrWeights[index]*(BufferBp-PrevBp))*1.0/(CurrBp-PrevBp);
-        WeightSum += Weight;
-        Dosage += Weight * InputData[index].CurrentHapDosage[Sample];
+        Data.Prev[j] = PrevWeights + index*Weights.HapStride;
+        Data.Slope[j] = WeightSlopes.Row(0, index);
+        Data.Dosage[j] = InputData[index].GetData(VariantId);
+        Subset |= 1<<index;
     }
-    Dosage /= WeightSum;
 
-    CurrentMetaImputedDosage[Sample] = Dosage;
-    CurrentHapDosageSum += Dosage;
-    CurrentHapDosageSumSq += Dosage * Dosage;
+    // Weights are stored normalized, so only proper subsets of the studies
+    // need to be renormalized.
+    bool Renormalize = NoStudies < NoInPrefix;
+    Data.PrevSum = Data.SlopeSum = NULL;
+    if(Renormalize)
+    {
+        Data.PrevSum = GetSubsetWeightSums(Subset);
+        Data.SlopeSum = Data.PrevSum + Weights.HapStride;
+    }
+
+    if(CurrentSparse)
+        Kernels.InterpolateAt[NoStudies][Renormalize](Data, CurrentNonZeroHaps.data(), CurrentNonZeroHaps.size(),
+                                                      &CurrentMetaImputedDosage[0], CurrentHapDosageSum, CurrentHapDosageSumSq);
+    else
+        Kernels.Interpolate[NoStudies][Renormalize](Data, &CurrentMetaImputedDosage[0], NoHapsThisBatch,
+                                                    CurrentHapDosageSum, CurrentHapDosageSumSq);
 }
 
 
 void MetaMinimac::PrintMetaImputedData()
 {
-    for(int id=0; id<EndSamId-StartSamId; id++)
+    int hap = 0;
+    int next = 0, NoNonZero = CurrentNonZeroHaps.size();
+    for(int run=0; run<(int)PloidyRuns.size(); run++)
     {
-        if( InputData[0].SampleNoHaplotypes[StartSamId+id]==2 )
-            PrintDiploidDosage((CurrentMetaImputedDosage[2*id]), (CurrentMetaImputedDosage[2*id+1]));
-        else
-            PrintHaploidDosage((CurrentMetaImputedDosage[2*id]));
+        int Ploidy = PloidyRuns[run].Ploidy;
+        int NoSamplesInRun = PloidyRuns[run].NoSamples;
+        for(int id=0; id<NoSamplesInRun; id++, hap+=Ploidy)
+        {
+            if(CurrentSparse)
+            {
+                // Copy the samples up to the next nonzero haplotype at once
+                while(next<NoNonZero && CurrentNonZeroHaps[next]<hap)
+                    next++;
+                int NextHap = next<NoNonZero ? CurrentNonZeroHaps[next] : NoHapsThisBatch;
+                int NoZeroSamples = min(NoSamplesInRun-id, (NextHap-hap)/Ploidy);
+                if(NoZeroSamples > 0)
+                {
+                    PrintZeroSamples(Ploidy, NoZeroSamples);
+                    id += NoZeroSamples-1;
+                    hap += (NoZeroSamples-1)*Ploidy;
+                    continue;
+                }
+            }
+
+            if(Ploidy==2)
+                PrintDiploidDosage(CurrentHapDosage[hap], CurrentHapDosage[hap+1]);
+            else
+                PrintHaploidDosage(CurrentHapDosage[hap]);
+        }
     }
 
     VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"\n");
@@ -1070,17 +1289,20 @@ void MetaMinimac::PrintMetaImputedRsq()
 
 void MetaMinimac::PrintMetaWeight()
 {
-    for(int id=0; id<EndSamId-StartSamId; id++)
+    int hap = 0;
+    for(int run=0; run<(int)PloidyRuns.size(); run++)
     {
-        WeightPrintStringPointerLength += sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,"\t");
-        if(InputData[0].SampleNoHaplotypes[StartSamId+id]==2)
+        int NoSamplesInRun = PloidyRuns[run].NoSamples;
+        for(int id=0; id<NoSamplesInRun; id++)
         {
-            PrintWeightForHaplotype(2*id);
-            WeightPrintStringPointerLength += sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,"|");
-            PrintWeightForHaplotype(2*id+1);
+            WeightPrintStringPointerLength += sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,"\t");
+            (this->*PrintWeightForHaplotypeKernel)(hap++);
+            if(PloidyRuns[run].Ploidy==2)
+            {
+                WeightPrintStringPointerLength += sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,"|");
+                (this->*PrintWeightForHaplotypeKernel)(hap++);
+            }
         }
-        else
-            PrintWeightForHaplotype(2*id);
     }
 
     WeightPrintStringPointerLength+= sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,"\n");
@@ -1092,194 +1314,188 @@ void MetaMinimac::PrintMetaWeight()
 }
 
 
-void MetaMinimac::PrintDiploidDosage(float &x, float &y)
+void MetaMinimac::CreateZeroSampleRuns()
 {
-
-    bool colonIndex=false;
-    VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"\t");
-
-    if(x<0.0005 && y<0.0005)
+    // Fields of samples with zero dosage, for haploid and diploid samples,
+    // repeated so that runs of such samples are copied in a few chunks.
+    for(int Ploidy=1; Ploidy<=2; Ploidy++)
     {
+        string Field;
         if(myUserVariables.GT)
-        {
-
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"0|0");
-            colonIndex=true;
-        }
+            Field += Ploidy==2 ? ":0|0" : ":0";
         if(myUserVariables.DS)
-        {
-
-            if(colonIndex)
-                VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"0");
-            colonIndex=true;
-        }
+            Field += ":0";
         if(myUserVariables.HDS)
-        {
-
-            if(colonIndex)
-                VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"0,0");
-            colonIndex=true;
-        }
+            Field += Ploidy==2 ? ":0,0" : ":0";
         if(myUserVariables.GP)
-        {
-
-            if(colonIndex)
-                VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-            colonIndex=true;
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"1,0,0");
-        }
+            Field += Ploidy==2 ? ":1,0,0" : ":1,0";
         if(myUserVariables.SD)
-        {
-            if(colonIndex)
-                VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-            colonIndex=true;
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"0");
-        }
+            Field += ":0";
+        if(!Field.empty())
+            Field[0] = '\t';
+        else
+            Field = "\t";
+
+        ZeroSampleRun[Ploidy-1].clear();
+        for(int i=0; i<ZERO_RUN_SAMPLES; i++)
+            ZeroSampleRun[Ploidy-1] += Field;
+    }
+}
+
+void MetaMinimac::PrintZeroSamples(int Ploidy, int NoSamples)
+{
+    const string &Run = ZeroSampleRun[Ploidy-1];
+    int FieldLength = Run.size()/ZERO_RUN_SAMPLES;
+    while(NoSamples > 0)
+    {
+        int NoCopy = min(NoSamples, ZERO_RUN_SAMPLES);
+        memcpy(VcfPrintStringPointer+VcfPrintStringPointerLength, Run.data(), NoCopy*FieldLength);
+        VcfPrintStringPointerLength += NoCopy*FieldLength;
+        NoSamples -= NoCopy;
+    }
+}
+
+// Writes Value as "%.3f" would and returns the number of characters
+// written. Value*1000 is exact in double, so rounding it to the nearest
+// even integer is what printf does.
+int MetaMinimac::PrintDosage(char *Out, float Value)
+{
+    char *Start = Out;
+    double Scaled = Value*1000.0;
+    if(signbit(Scaled))
+    {
+        *Out++ = '-';
+        Scaled = -Scaled;
+    }
+    long long Rounded = (long long)nearbyint(Scaled);
+    Out += PrintInteger(Out, (int)(Rounded/1000));
+    int Fraction = Rounded%1000;
+    Out[0] = '.';
+    Out[1] = '0' + Fraction/100;
+    Out[2] = '0' + Fraction/10%10;
+    Out[3] = '0' + Fraction%10;
+    return Out+4 - Start;
+}
+
+void MetaMinimac::PrintDiploidDosage(float x, float y)
+{
+    if(x<0.0005 && y<0.0005)
+    {
+        PrintZeroSamples(2, 1);
         return;
     }
 
+    char *Out = VcfPrintStringPointer+VcfPrintStringPointerLength;
+    char *Start = Out;
+    bool colonIndex=false;
+    *Out++ = '\t';
 
     if(myUserVariables.GT)
     {
-
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%d|%d",(x>0.5),(y>0.5));
+        *Out++ = '0' + (x>0.5);
+        *Out++ = '|';
+        *Out++ = '0' + (y>0.5);
         colonIndex=true;
     }
     if(myUserVariables.DS)
     {
-
         if(colonIndex)
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%.3f",x+ y);
+            *Out++ = ':';
+        Out += PrintDosage(Out, x+ y);
         colonIndex=true;
     }
     if(myUserVariables.HDS)
     {
-
         if(colonIndex)
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%.3f,%.3f",x , y);
+            *Out++ = ':';
+        Out += PrintDosage(Out, x);
+        *Out++ = ',';
+        Out += PrintDosage(Out, y);
         colonIndex=true;
     }
     if(myUserVariables.GP)
     {
-
         if(colonIndex)
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
+            *Out++ = ':';
         colonIndex=true;
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%.3f,%.3f,%.3f",(1-x)*(1-y),x*(1-y)+y*(1-x),x*y);
+        Out += PrintDosage(Out, (1-x)*(1-y));
+        *Out++ = ',';
+        Out += PrintDosage(Out, x*(1-y)+y*(1-x));
+        *Out++ = ',';
+        Out += PrintDosage(Out, x*y);
     }
     if(myUserVariables.SD)
     {
         if(colonIndex)
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
+            *Out++ = ':';
         colonIndex=true;
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%.3f", x*(1-x) + y*(1-y));
+        Out += PrintDosage(Out, x*(1-x) + y*(1-y));
     }
 
-
-
+    VcfPrintStringPointerLength += Out - Start;
 }
 
-void MetaMinimac::PrintHaploidDosage(float &x)
+void MetaMinimac::PrintHaploidDosage(float x)
 {
-    bool colonIndex=false;
-    VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"\t");
-
     if(x<0.0005)
     {
-        if(myUserVariables.GT)
-        {
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"0");
-            colonIndex=true;
-        }
-        if(myUserVariables.DS)
-        {
-
-            if(colonIndex)
-                VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"0");
-            colonIndex=true;
-        }
-        if(myUserVariables.HDS)
-        {
-
-            if(colonIndex)
-                VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"0");
-            colonIndex=true;
-        }
-        if(myUserVariables.GP)
-        {
-
-            if(colonIndex)
-                VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-            colonIndex=true;
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"1,0");
-        }
-        if(myUserVariables.SD)
-        {
-            if(colonIndex)
-                VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-            colonIndex=true;
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"0");
-        }
+        PrintZeroSamples(1, 1);
         return;
-
     }
 
-
+    char *Out = VcfPrintStringPointer+VcfPrintStringPointerLength;
+    char *Start = Out;
+    bool colonIndex=false;
+    *Out++ = '\t';
 
     if(myUserVariables.GT)
     {
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%d",(x>0.5));
+        *Out++ = '0' + (x>0.5);
         colonIndex=true;
     }
     if(myUserVariables.DS)
     {
-
         if(colonIndex)
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%.3f",x);
+            *Out++ = ':';
+        Out += PrintDosage(Out, x);
         colonIndex=true;
     }
     if(myUserVariables.HDS)
     {
-
         if(colonIndex)
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%.3f",x );
+            *Out++ = ':';
+        Out += PrintDosage(Out, x);
         colonIndex=true;
     }
     if(myUserVariables.GP)
     {
-
         if(colonIndex)
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
+            *Out++ = ':';
         colonIndex=true;
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%.3f,%.3f",1-x,x);
+        Out += PrintDosage(Out, 1-x);
+        *Out++ = ',';
+        Out += PrintDosage(Out, x);
     }
     if(myUserVariables.SD)
     {
         if(colonIndex)
-            VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,":");
+            *Out++ = ':';
         colonIndex=true;
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength,"%.3f", x*(1-x));
+        Out += PrintDosage(Out, x*(1-x));
     }
+
+    VcfPrintStringPointerLength += Out - Start;
 }
 
 
+template<int K>
 void MetaMinimac::PrintWeightForHaplotype(int haploId)
 {
-    vector<double>& ThisCurrWeights = (*CurrWeights)[haploId];
-    double WeightSum = 0.0;
-    for(int i=0; i<NoInPrefix; i++)
-        WeightSum += ThisCurrWeights[i];
-    WeightPrintStringPointerLength += sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,"%0.4f", ThisCurrWeights[0]/WeightSum);
-    for(int i=1;i<NoInPrefix;i++)
-        WeightPrintStringPointerLength += sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,",%0.4f", ThisCurrWeights[i]/WeightSum);
+    int Stride = Weights.HapStride;
+    const double *ThisCurrWeights = CurrWeights + haploId;
+    WeightPrintStringPointerLength += sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,"%0.4f", ThisCurrWeights[0]);
+    for(int i=1;i<K;i++)
+        WeightPrintStringPointerLength += sprintf(WeightPrintStringPointer+WeightPrintStringPointerLength,",%0.4f", ThisCurrWeights[i*Stride]);
 }
 
 
@@ -1322,7 +1538,9 @@ void MetaMinimac::AppendtoMainVcf()
     {
         line.clear();
         vcfdosepartialList[0]->readLine(line);
-        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength, "%s%s\t%s",line.c_str(), CreateRsqInfo().c_str(), myUserVariables.formatStringForVCF.c_str());
+        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength, "%s",line.c_str());
+        VcfPrintStringPointerLength+=PrintRsqInfo(VcfPrintStringPointer+VcfPrintStringPointerLength);
+        VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength, "\t%s", myUserVariables.formatStringForVCF.c_str());
 
         for(int j=1;j<=batchNo;j++)
         {
@@ -1374,18 +1592,34 @@ void MetaMinimac::AppendtoMainVcf()
 
 void MetaMinimac::PrintVariantInfo()
 {
-    VcfPrintStringPointerLength+=sprintf(VcfPrintStringPointer+VcfPrintStringPointerLength, "%s\t%d\t%s\t%s\t%s\t.\tPASS\t%s\t%s",
-                                         CurrentVariant->chr.c_str(), CurrentVariant->bp, CurrentVariant->name.c_str(),
-                                         CurrentVariant->refAlleleString.c_str(), CurrentVariant->altAlleleString.c_str(),
-                                         CreateInfo().c_str(), myUserVariables.formatStringForVCF.c_str());
+    char *Out = VcfPrintStringPointer+VcfPrintStringPointerLength;
+    Out += sprintf(Out, "%s\t%d\t%s\t%s\t%s\t.\tPASS\t",
+                   CurrentVariant->chr.c_str(), CurrentVariant->bp, CurrentVariant->name.c_str(),
+                   CurrentVariant->refAlleleString.c_str(), CurrentVariant->altAlleleString.c_str());
+    if(myUserVariables.infoDetails)
+    {
+        Out += PrintStudyInfo(Out);
+        Out += PrintFrequencyInfo(Out, CurrentHapDosageSum, CurrentHapDosageSumSq);
+    }
+    else
+        *Out++ = '.';
+    Out += sprintf(Out, "\t%s", myUserVariables.formatStringForVCF.c_str());
+    VcfPrintStringPointerLength = Out - VcfPrintStringPointer;
 }
 
 void MetaMinimac::PrintVariantPartialInfo()
 {
-    SnpPrintStringPointerLength+=sprintf(SnpPrintStringPointer+SnpPrintStringPointerLength, "%s\t%d\t%s\t%s\t%s\t.\tPASS\t%s\n",
-                                         CurrentVariant->chr.c_str(), CurrentVariant->bp, CurrentVariant->name.c_str(),
-                                         CurrentVariant->refAlleleString.c_str(), CurrentVariant->altAlleleString.c_str(),
-                                         CreatePartialInfo().c_str());
+    char *Out = SnpPrintStringPointer+SnpPrintStringPointerLength;
+    Out += sprintf(Out, "%s\t%d\t%s\t%s\t%s\t.\tPASS\t",
+                   CurrentVariant->chr.c_str(), CurrentVariant->bp, CurrentVariant->name.c_str(),
+                   CurrentVariant->refAlleleString.c_str(), CurrentVariant->altAlleleString.c_str());
+    if(myUserVariables.infoDetails)
+        Out += PrintStudyInfo(Out);
+    else
+        *Out++ = '.';
+    *Out++ = '\n';
+    *Out = '\0';
+    SnpPrintStringPointerLength = Out - SnpPrintStringPointer;
     if(SnpPrintStringPointerLength > 0.9 * (float)(myUserVariables.PrintBuffer))
     {
         ifprintf(vcfsnppartial,"%s",SnpPrintStringPointer);
@@ -1393,98 +1627,83 @@ void MetaMinimac::PrintVariantPartialInfo()
     }
 }
 
-string MetaMinimac::CreateInfo()
+// Writes NST, the S# of each study and TRAINING of the current variant to
+// Out and returns the number of characters written.
+int MetaMinimac::PrintStudyInfo(char *Out)
 {
-    if(!myUserVariables.infoDetails)
-        return ".";
-
-    double hapSum = CurrentHapDosageSum, hapSumSq = CurrentHapDosageSumSq;
-    double freq = hapSum*1.0/NoHaplotypes;
-    double maf = (freq > 0.5) ? (1.0 - freq) : freq;
-    double rsq = 0.0, evar = freq*(1-freq), ovar = 0.0;
-    if (NoHaplotypes > 2 & (hapSumSq - hapSum * hapSum / NoHaplotypes) >0 )
-    {
-        ovar = (hapSumSq - hapSum * hapSum / NoHaplotypes)/ NoHaplotypes;
-        rsq = ovar / (evar + 1e-30);
-    }
-
-    stringstream ss;
-
-    ss<<"NST=";
-    ss<<CurrentVariant->NoStudiesHasVariant;
+    char *Start = Out;
+    memcpy(Out, "NST=", 4);
+    Out += 4;
+    Out += PrintInteger(Out, CurrentVariant->NoStudiesHasVariant);
     for(int i=0; i<CurrentVariant->NoStudiesHasVariant; i++)
     {
-        ss<<";S";
-        ss<<CurrentVariant->StudiesHasVariant[i]+1;
+        memcpy(Out, ";S", 2);
+        Out += 2;
+        Out += PrintInteger(Out, CurrentVariant->StudiesHasVariant[i]+1);
     }
 
-    if(CurrentVariant->name == CommonGenotypeVariantNameList[NoCommonVariantsProcessed-1])
+    variant *Typed = NoCommonVariantsProcessed > 0 ? &CommonTypedVariantList[NoCommonVariantsProcessed-1] : NULL;
+    if(Typed != NULL && CurrentVariant->key == Typed->key
+       && SameVariant(Typed->key, Typed->bp, Typed->refAlleleString.c_str(), Typed->altAlleleString.c_str(),
+                      CurrentVariant->bp, CurrentVariant->refAlleleString.c_str(), CurrentVariant->altAlleleString.c_str()))
     {
-        ss<<";TRAINING";
+        memcpy(Out, ";TRAINING", 9);
+        Out += 9;
     }
-
-    ss<< ";AF=" << fixed << setprecision(5) << freq <<";MAF=";
-    ss<< fixed << setprecision(5) << maf <<";R2=";
-    ss<< fixed << setprecision(5) << rsq ;
-
-    return ss.str();
+    *Out = '\0';
+    return Out - Start;
 }
 
-string MetaMinimac::CreatePartialInfo()
+// Writes AF, MAF and R2 from the haplotype dosage sums to Out and returns
+// the number of characters written.
+int MetaMinimac::PrintFrequencyInfo(char *Out, double hapSum, double hapSumSq)
 {
-    if(!myUserVariables.infoDetails)
-        return ".";
-
-    stringstream ss;
-
-    ss<<"NST=";
-    ss<<CurrentVariant->NoStudiesHasVariant;
-    for(int i=0; i<CurrentVariant->NoStudiesHasVariant; i++)
+    double freq = hapSum*1.0/NoHaplotypes;
+    double maf = (freq > 0.5) ? (1.0 - freq) : freq;
+    double rsq = 0.0, evar = freq*(1-freq), ovar = 0.0;
+    if (NoHaplotypes > 2 & (hapSumSq - hapSum * hapSum / NoHaplotypes) >0 )
     {
-        ss<<";S";
-        ss<<CurrentVariant->StudiesHasVariant[i]+1;
+        ovar = (hapSumSq - hapSum * hapSum / NoHaplotypes)/ NoHaplotypes;
+        rsq = ovar / (evar + 1e-30);
     }
+    return sprintf(Out, ";AF=%.5f;MAF=%.5f;R2=%.5f", freq, maf, rsq);
+}
 
-    if(CurrentVariant->name == CommonGenotypeVariantNameList[NoCommonVariantsProcessed-1])
+int MetaMinimac::PrintInteger(char *Out, int Value)
+{
+    char Digits[12];
+    int NoDigits = 0;
+    do
     {
-        ss<<";TRAINING";
-    }
+        Digits[NoDigits++] = '0' + Value%10;
+        Value /= 10;
+    }while(Value > 0);
 
-    return ss.str();
+    for(int i=0; i<NoDigits; i++)
+        Out[i] = Digits[NoDigits-1-i];
+    return NoDigits;
 }
 
-string MetaMinimac::CreateRsqInfo()
+// Sums the haplotype dosage sums of all batches for the next variant and
+// writes its AF, MAF and R2 to Out.
+int MetaMinimac::PrintRsqInfo(char *Out)
 {
     if(!myUserVariables.infoDetails)
-        return "";
-
-    double hapSum = 0.0, hapSumSq = 0.0;
-    string line;
-    char* sum, * sumsq;
-    for(int i=0;i<batchNo;i++)
     {
-        line.clear();
-        vcfrsqpartialList[i]->readLine(line);
-        sum = strtok((char*)line.c_str(), "\t");
-        sumsq = strtok(NULL, "\t");
-
-        hapSum += stod(sum);
-        hapSumSq += stod(sumsq);
+        *Out = '\0';
+        return 0;
     }
 
-    double freq = hapSum*1.0/NoHaplotypes;
-    double maf = (freq > 0.5) ? (1.0 - freq) : freq;
-    double rsq = 0.0, evar = freq*(1-freq), ovar = 0.0;
-    if (NoHaplotypes > 2 & (hapSumSq - hapSum * hapSum / NoHaplotypes) >0 )
+    double hapSum = 0.0, hapSumSq = 0.0;
+    for(int i=0;i<batchNo;i++)
     {
-        ovar = (hapSumSq - hapSum * hapSum / NoHaplotypes)/ NoHaplotypes;
-        rsq = ovar / (evar + 1e-30);
+        RsqLine.clear();
+        vcfrsqpartialList[i]->readLine(RsqLine);
+        char *end_str;
+        hapSum += strtod(RsqLine.c_str(), &end_str);
+        hapSumSq += strtod(end_str, NULL);
     }
-    stringstream ss;
-    ss<< ";AF=" << fixed << setprecision(5) << freq <<";MAF=";
-    ss<< fixed << setprecision(5) << maf <<";R2=";
-    ss<< fixed << setprecision(5) << rsq ;
-    return ss.str();
+    return PrintFrequencyInfo(Out, hapSum, hapSumSq);
 }
 
 void MetaMinimac::PrintWeightVariantInfo()
@@ -1557,7 +1776,7 @@ void MetaMinimac::ClearCurrentBuffer()
     NoVariants += BufferNoVariants;
     for(int i=0; i<NoInPrefix; i++)
         InputData[i].ClearBuffer();
-    BufferVariantList.clear();
+    BufferVariantIndex.clear();
     BufferNoVariants = 0;
     BufferBp = CurrentFirstVariantBp;
 }
\ No newline at end of file
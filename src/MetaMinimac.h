@@ -3,10 +3,36 @@
 
 #include "MyVariables.h"
 #include "HaplotypeSet.h"
+#include "WeightTensor.h"
+#include "HMMKernels.h"
+#include "CompactWeights.h"
+#include "VariantKey.h"
+#include <unordered_map>
 
 using namespace std;
 
-void logitTransform(vector<double> &From,vector<double> &To);
+// Maps K-1 log-odds onto K weights summing to one.
+template<int K>
+void logitTransform(const double *From, double *To)
+{
+    double sum=1.0;
+    for(int i=0; i < (K-1); i++) sum+=exp(From[i]);
+    for(int i=0; i < (K-1); i++)  To[i]=exp(From[i])/sum;
+    To[K-1]=1.0/sum;
+
+
+    double checkSum=0.0;
+    for(int i=0;i<K;i++)
+        checkSum+=To[i];
+    if(checkSum>1.0001)
+        abort();
+}
+
+// Consecutive samples of a batch that share a ploidy.
+struct PloidyRun
+{
+    int Ploidy, NoSamples;
+};
 
 class MetaMinimac
 {
@@ -17,13 +43,13 @@ public:
     string finChromosome;
 
     vector<variant> CommonTypedVariantList;
-    vector<string> CommonGenotypeVariantNameList;
     int NoHaplotypes, NoSamples;
     int NoVariants, NoCommonTypedVariants;
 
     // Variables for input dosage file stream and records
-    vector<VcfFileReader*> InputDosageStream;
-    vector<VcfRecord*> CurrentRecordFromStudy;
+    vector<VcfRecordReader*> InputDosageStream;
+    vector<int> CurrentBpFromStudy;
+    vector<unsigned long long> CurrentVariantKeyFromStudy;
     vector<int> StudiesHasVariant;
     int CurrentFirstVariantBp;
     int NoStudiesHasVariant;
@@ -32,13 +58,29 @@ public:
 
     // Process Part of Samples each time
     int StartSamId, EndSamId;
+    int NoHapsThisBatch;
+    vector<PloidyRun> PloidyRuns;
     double lambda;
     vector<double> TransitionProb;
-    double Recom, backgroundError;
-    double JumpFix, JumpThreshold;
-    vector<vector<vector<double>>> Weights;
-    vector<vector<double>> PrevRightProb;
+    double backgroundError;
+    int SegmentLength, NoSegments;
+    WeightTensor Weights;
+    WeightTensor Checkpoints;
+    WeightTensor BoundaryWeights;
+    WeightTensor PrevRightProb;
+    CompactWeights CompactPosterior;
+    WeightTensor ExpandedWeights;
+    WeightTensor FitEquations;
+    WeightTensor WeightSlopes;
+    WeightTensor SubsetWeightSums;
+    vector<bool> SubsetSumsReady;
+    int InterpolationInterval;
     int NoCommonVariantsProcessed;
+    HMMKernels Kernels;
+
+    // Kernels specialized on the number of studies, picked once at startup
+    void (MetaMinimac::*InitiateLeftProbKernel)(int, int);
+    void (MetaMinimac::*PrintWeightForHaplotypeKernel)(int);
 
     // Output files
     IFILE vcfdosepartial, vcfweightpartial;
@@ -51,28 +93,31 @@ public:
     int VcfPrintStringPointerLength, WeightPrintStringPointerLength, RsqPrintStringPointerLength, SnpPrintStringPointerLength;
     int batchNo;
     vector<IFILE> vcfrsqpartialList;
+    string RsqLine;
 
     variant* CurrentVariant;
     int PrevBp, CurrBp;
-    vector<vector<double>> *PrevWeights;
-    vector<vector<double>> *CurrWeights;
+    double *PrevWeights;
+    double *CurrWeights;
     vector<float> CurrentMetaImputedDosage;
+    const float *CurrentHapDosage;
+    vector<int> CurrentNonZeroHaps;
+    bool CurrentSparse;
+    string ZeroSampleRun[2];
 
-    float CurrentHapDosageSum, CurrentHapDosageSumSq;
+    double CurrentHapDosageSum, CurrentHapDosageSumSq;
 
     // Buffer
     int NoRecords;
     int BufferBp, BufferNoVariants;
     vector<variant> BufferVariantList;
+    unordered_multimap<unsigned long long, int> BufferVariantIndex;
 
 
     MetaMinimac()
     {
         lambda = 2e-7;
-        Recom = 1e-3;
         backgroundError = 1e-5;
-        JumpThreshold = 1e-10;
-        JumpFix = 1e10;
     };
 
 
@@ -81,31 +126,39 @@ public:
 
     bool ParseInputVCFFiles();
     bool CheckSampleNameCompatibility();
-    void OpenStreamInputDosageFiles(bool siteOnly);
+    void OpenStreamInputDosageFiles();
     void CloseStreamInputDosageFiles();
     bool OpenStreamOutputDosageFiles();
     string GetDosageFileFullName(String prefix);
     bool doesExistFile(String filename);
 
     bool LoadEmpVariantInfo();
+    void ReadEmpVariant(int Study, variant &ThisVariant);
     void FindCommonGenotypedVariants();
     void FindCurrentMinimumPosition();
-    int IsVariantEqual(VcfRecord &Rec1, VcfRecord &Rec2);
+    void ReadCurrentRecord(int Study);
     void UpdateCurrentRecords();
 
+    void CreatePloidyRuns();
     void LoadLooDosage();
 
     String PerformFinalAnalysis();
     void CalculateWeights();
     void InitiateWeights();
     void CalculateLeftProbs();
-    void CalculatePosterior();
-    void InitiateLeftProb(int SampleInBatch);
-    void InitiateRightProb(int SampleInBatch);
-    void UpdateOneStepLeft(int SampleInBatch);
-    void UpdateOneStepRight(int SampleInBatch);
+    void CalculatePosterior(int Segment);
+    void InitializeKernels();
+    template<int K> void SelectKernels();
+    template<int K, bool ActiveSet> void InitiateLeftProbs(int HapStart, int HapEnd);
+    void GetHaplotypeBlock(int Block, int NoBlocks, int &HapStart, int &HapEnd);
+    void GetSegment(int Segment, int &First, int &Last);
+    void GetStep(int TypedId, int HapStart, double Recom, HMMSiteData &Site, HMMStepParameters &Param);
+    void CalculateSegmentLeftProbs(int HapStart, int HapEnd, int Segment);
+    void UpdateOneStepLeft(int HapStart, int HapEnd, int TypedId, const double *PrevLeft, double *CurrLeft);
+    void UpdateOneStepRight(int HapStart, int HapEnd, int TypedId, double *CurrWeight);
     void MetaImputeAndOutput();
     void UpdateWeights();
+    double* LoadPosterior(int TypedId);
     void OutputPartialVcf();
     void OutputAllVcf();
 
@@ -119,7 +172,10 @@ public:
     void ClearCurrentBuffer();
     void ReadCurrentDosageData();
     void CreateMetaImputedData(int VariantId);
-    void MetaImpute(int Sample);
+    bool FindNonZeroHaplotypes(int VariantId);
+    void PrepareInterpolation();
+    const double* GetSubsetWeightSums(int Subset);
+    void MetaImpute(int VariantId);
     void PrintMetaImputedData();
     void PrintMetaWeight();
     void PrintVariantInfo();
@@ -127,12 +183,16 @@ public:
     void PrintWeightVariantInfo();
     void PrintMetaImputedRsq();
 
-    string CreateInfo();
-    string CreatePartialInfo();
-    string CreateRsqInfo();
-    void PrintDiploidDosage(float &x, float &y);
-    void PrintHaploidDosage(float &x);
-    void PrintWeightForHaplotype(int haploId);
+    int PrintStudyInfo(char *Out);
+    int PrintFrequencyInfo(char *Out, double hapSum, double hapSumSq);
+    int PrintInteger(char *Out, int Value);
+    int PrintRsqInfo(char *Out);
+    void CreateZeroSampleRuns();
+    void PrintZeroSamples(int Ploidy, int NoSamples);
+    int PrintDosage(char *Out, float Value);
+    void PrintDiploidDosage(float x, float y);
+    void PrintHaploidDosage(float x);
+    template<int K> void PrintWeightForHaplotype(int haploId);
     void summary()
     {
         cout << " Total #Sites = " << NoVariants << endl;
@@ -19,6 +19,10 @@ public:
     bool GT, DS, HDS, GP, SD;
     bool gzip, nobgzip;
     bool log;
+    int cpus;
+    bool checkpoint;
+    String precision;
+    String minimizer;
 
     string CommandLine;
 
@@ -42,6 +46,10 @@ public:
         nobgzip = false;
         VcfBuffer = 1000;
         log = false;
+        cpus = 1;
+        checkpoint = false;
+        precision = "double";
+        minimizer = "activeSet";
     };
 
     void Status()
@@ -53,7 +61,11 @@ public:
         printf( "      --skipInfo %s,", infoDetails?"":"[ON]");
         printf( " --nobgzip %s,", nobgzip?"[ON]":"");
         printf( " --weight %s,", debug?"[ON]":"");
-        printf( " --log %s", log?"[ON]":"");
+        printf( " --log %s,", log?"[ON]":"");
+        printf( " --threads [%d],", cpus);
+        printf( " --checkpoint %s,", checkpoint?"[ON]":"");
+        printf( " --precision [%s],", precision.c_str());
+        printf( " --minimizer [%s]", minimizer.c_str());
         printf("\n\n");
     }
 
@@ -167,6 +179,33 @@ public:
             return false;
         }
 
+        if(cpus<1)
+        {
+            cout << " ERROR !!! \n Invalid input for -t [--threads] = "<<cpus<<"\n";
+            cout << " Number of threads should be at least 1 !!! \n\n";
+            cout<< " Try -h [--help] for usage ...\n\n";
+            cout<<  " Program Exiting ..."<<endl<<endl;
+            return false;
+        }
+
+        if(precision != "double" && precision != "float" && precision != "half")
+        {
+            cout << " ERROR !!! \n Invalid input for -p [--precision] = "<<precision<<"\n";
+            cout << " Available precisions are double, float and half !!! \n\n";
+            cout<< " Try -h [--help] for usage ...\n\n";
+            cout<<  " Program Exiting ..."<<endl<<endl;
+            return false;
+        }
+
+        if(minimizer != "activeSet" && minimizer != "simplex")
+        {
+            cout << " ERROR !!! \n Invalid input for -m [--minimizer] = "<<minimizer<<"\n";
+            cout << " Available minimizers are activeSet and simplex !!! \n\n";
+            cout<< " Try -h [--help] for usage ...\n\n";
+            cout<<  " Program Exiting ..."<<endl<<endl;
+            return false;
+        }
+
         return true;
     };
 };
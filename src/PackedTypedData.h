@@ -0,0 +1,69 @@
+#ifndef METAM_PACKEDTYPEDDATA_H
+#define METAM_PACKEDTYPEDDATA_H
+
+#include "WeightTensor.h"
+
+#define LOO_DOSAGE_SCALE 65535.0
+
+// Leave-one-out dosages and typed genotypes of one study at the common
+// typed sites of a batch, in one aligned block laid out site by site. Each
+// site holds the dosages of all haplotypes in 16-bit fixed point on [0,1],
+// followed by the genotypes packed one bit per haplotype, least significant
+// bit first. Both rows start on the alignment, so a block of haplotypes
+// starting on a multiple of 8 is addressed by plain pointer offsets.
+class PackedTypedData
+{
+public:
+
+    int NoSites, NoHaps;
+    int DosageBytes;
+
+    PackedTypedData()
+    {
+        NoSites = NoHaps = DosageBytes = 0;
+    };
+
+    void Resize(int sites, int haps)
+    {
+        NoSites = sites;
+        NoHaps = haps;
+        DosageBytes = (haps*sizeof(unsigned short) + WEIGHT_ALIGNMENT - 1)/WEIGHT_ALIGNMENT*WEIGHT_ALIGNMENT;
+        Block.Resize(sites, 1, DosageBytes + (haps + 7)/8);
+        memset(Block.Data, 0, (size_t)sites*Block.HapStride);
+    };
+
+    unsigned short* Dosage(int site)
+    {
+        return (unsigned short*)Block.Site(site);
+    };
+
+    unsigned char* GT(int site)
+    {
+        return Block.Site(site) + DosageBytes;
+    };
+
+    float GetDosage(int site, int hap)
+    {
+        return Dosage(site)[hap]*(float)(1.0/LOO_DOSAGE_SCALE);
+    };
+
+    int GetGT(int site, int hap)
+    {
+        return (GT(site)[hap>>3] >> (hap&7)) & 1;
+    };
+
+    void Set(int site, int hap, float LooDosage, bool Alt)
+    {
+        if(LooDosage < 0) LooDosage = 0;
+        if(LooDosage > 1) LooDosage = 1;
+        Dosage(site)[hap] = (unsigned short)(LooDosage*LOO_DOSAGE_SCALE + 0.5);
+        if(Alt)
+            GT(site)[hap>>3] |= (unsigned char)(1 << (hap&7));
+    };
+
+private:
+
+    AlignedTensor<unsigned char> Block;
+};
+
+#endif //METAM_PACKEDTYPEDDATA_H
@@ -0,0 +1,74 @@
+#include "VariantKey.h"
+#include <cstring>
+
+#define ALLELE_MAX_LENGTH 7
+#define ALLELE_MAX_BASES 14
+#define ALLELE_HASHED (1ULL << (VARIANT_KEY_ALLELE_BITS-1))
+#define ALLELE_HASH_MASK (ALLELE_HASHED-1)
+
+static inline int BaseCode(char Base)
+{
+    switch(Base)
+    {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return -1;
+    }
+}
+
+// Packs the alleles exactly as refLen(3) altLen(3) bases(2 each), or
+// returns false if they do not fit.
+static bool PackAlleles(const char *Ref, const char *Alt, unsigned long long &Code)
+{
+    int RefLength = strlen(Ref), AltLength = strlen(Alt);
+    if(RefLength > ALLELE_MAX_LENGTH || AltLength > ALLELE_MAX_LENGTH || RefLength+AltLength > ALLELE_MAX_BASES)
+        return false;
+
+    Code = ((unsigned long long)RefLength << 3) | AltLength;
+    for(const char *c=Ref; *c; c++)
+    {
+        int Base = BaseCode(*c);
+        if(Base < 0)
+            return false;
+        Code = (Code << 2) | Base;
+    }
+    for(const char *c=Alt; *c; c++)
+    {
+        int Base = BaseCode(*c);
+        if(Base < 0)
+            return false;
+        Code = (Code << 2) | Base;
+    }
+    return true;
+}
+
+unsigned long long GetVariantKey(int bp, const char *Ref, const char *Alt)
+{
+    unsigned long long Position = (unsigned long long)(bp < VARIANT_KEY_MAX_BP ? bp : VARIANT_KEY_MAX_BP);
+    Position <<= VARIANT_KEY_ALLELE_BITS;
+
+    unsigned long long Code;
+    if(bp < VARIANT_KEY_MAX_BP && PackAlleles(Ref, Alt, Code))
+        return Position | Code;
+
+    unsigned long long Hash = 14695981039346656037ULL;
+    for(const char *c=Ref; *c; c++)
+        Hash = (Hash ^ (unsigned char)*c) * 1099511628211ULL;
+    Hash = (Hash ^ '\t') * 1099511628211ULL;
+    for(const char *c=Alt; *c; c++)
+        Hash = (Hash ^ (unsigned char)*c) * 1099511628211ULL;
+    if(bp >= VARIANT_KEY_MAX_BP)
+        Hash = (Hash ^ (unsigned int)bp) * 1099511628211ULL;
+
+    return Position | ALLELE_HASHED | (Hash & ALLELE_HASH_MASK);
+}
+
+bool SameVariant(unsigned long long Key, int bp1, const char *Ref1, const char *Alt1,
+                 int bp2, const char *Ref2, const char *Alt2)
+{
+    if(!(Key & ALLELE_HASHED))
+        return true;
+    return bp1 == bp2 && strcmp(Ref1, Ref2) == 0 && strcmp(Alt1, Alt2) == 0;
+}
@@ -0,0 +1,29 @@
+#ifndef METAM_VARIANTKEY_H
+#define METAM_VARIANTKEY_H
+
+// 64-bit identity of a variant on the chromosome being processed, computed
+// once when a record is read so that records are matched without building
+// or comparing chr:bp:ref:alt strings. The position takes the upper 28 bits
+// and the alleles the lower 36:
+//
+//      exact  : REF and ALT of at most 7 bases of ACGT each, and at most 14
+//               bases together, stored as their lengths and 2 bits a base.
+//               These cover nearly all SNPs and short indels.
+//      hashed : everything else, as a 35-bit hash with the top allele bit
+//               set. Positions beyond the key range share the largest one
+//               and are hashed with the alleles.
+//
+// Keys of equal variants are equal and keys order by position first. Two
+// variants can only share a hashed key, so records with equal keys are
+// matched with SameVariant, which compares the alleles of hashed keys.
+
+#define VARIANT_KEY_ALLELE_BITS 36
+#define VARIANT_KEY_MAX_BP ((1 << (64-VARIANT_KEY_ALLELE_BITS)) - 1)
+
+unsigned long long GetVariantKey(int bp, const char *Ref, const char *Alt);
+
+// Whether two variants with the same Key are the same variant.
+bool SameVariant(unsigned long long Key, int bp1, const char *Ref1, const char *Alt1,
+                 int bp2, const char *Ref2, const char *Alt2);
+
+#endif //METAM_VARIANTKEY_H
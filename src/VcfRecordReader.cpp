@@ -0,0 +1,236 @@
+#include "VcfRecordReader.h"
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+
+#define READ_CHUNK (1 << 20)
+#define MAX_EXACT_DIGITS 15
+
+static const double PowersOf10[MAX_EXACT_DIGITS+1] =
+    {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+VcfRecordReader::VcfRecordReader()
+{
+    File = NULL;
+    BufferStart = BufferEnd = 0;
+    EndOfFile = false;
+    Line = LineEnd = NULL;
+    Chrom = Ref = Alt = Format = "";
+    Position = 0;
+    Samples = NULL;
+    FirstSample = 0;
+    LastSample = INT_MAX;
+    ColumnsReady = false;
+}
+
+VcfRecordReader::~VcfRecordReader()
+{
+    Close();
+}
+
+bool VcfRecordReader::Open(const char *FileName, int NoThreads)
+{
+    Close();
+    if(!Bgzf.Open(FileName, NoThreads))
+    {
+        File = ifopen(FileName, "r");
+        if(File == NULL)
+            return false;
+    }
+    Buffer.resize(READ_CHUNK+1);
+    BufferStart = BufferEnd = 0;
+    EndOfFile = false;
+
+    SampleNames.clear();
+    while(ReadLine())
+    {
+        if(Line[0]=='#' && Line[1]=='#')
+            continue;
+        if(strncmp(Line, "#CHROM", 6) != 0)
+            return false;
+
+        char *Field = Line;
+        for(int Column=0; Field != NULL; Column++)
+        {
+            char *Next = strchr(Field, '\t');
+            if(Next != NULL)
+                *Next++ = '\0';
+            if(Column >= 9)
+                SampleNames.push_back(Field);
+            Field = Next;
+        }
+        return true;
+    }
+    return false;
+}
+
+void VcfRecordReader::Close()
+{
+    if(File != NULL)
+        ifclose(File);
+    File = NULL;
+    Bgzf.Close();
+}
+
+bool VcfRecordReader::ReadLine()
+{
+    while(true)
+    {
+        char *Start = &Buffer[BufferStart];
+        char *End = (char*)memchr(Start, '\n', BufferEnd-BufferStart);
+        if(End == NULL && EndOfFile)
+        {
+            if(BufferStart == BufferEnd)
+                return false;
+            End = &Buffer[BufferEnd];
+        }
+
+        if(End != NULL)
+        {
+            BufferStart = End - &Buffer[0] + (End < &Buffer[BufferEnd]);
+            if(End > Start && End[-1] == '\r')
+                End--;
+            *End = '\0';
+            Line = Start;
+            LineEnd = End;
+            return true;
+        }
+
+        // Move the partial line to the front, and grow the buffer if it
+        // already fills all of it.
+        memmove(&Buffer[0], Start, BufferEnd-BufferStart);
+        BufferEnd -= BufferStart;
+        BufferStart = 0;
+        if(Buffer.size()-1-BufferEnd < READ_CHUNK/2)
+            Buffer.resize(2*Buffer.size());
+
+        unsigned int NoRead;
+        if(Bgzf.IsOpen())
+            NoRead = Bgzf.Read(&Buffer[BufferEnd], Buffer.size()-1-BufferEnd);
+        else
+            NoRead = ifread(File, &Buffer[BufferEnd], Buffer.size()-1-BufferEnd);
+        if(NoRead == 0)
+            EndOfFile = true;
+        BufferEnd += NoRead;
+    }
+}
+
+bool VcfRecordReader::ReadRecord()
+{
+    do
+    {
+        if(!ReadLine())
+            return false;
+    }while(Line[0]=='\0' || Line[0]=='#');
+
+    // CHROM POS ID REF ALT QUAL FILTER INFO FORMAT, then the samples
+    char *Fields[9];
+    char *Field = Line;
+    for(int Column=0; Column<9; Column++)
+    {
+        Fields[Column] = Field;
+        if(Field == NULL)
+            continue;
+        Field = strchr(Field, '\t');
+        if(Field != NULL)
+            *Field++ = '\0';
+    }
+
+    Chrom = Fields[0];
+    Position = Fields[1] ? atoi(Fields[1]) : 0;
+    Ref = Fields[3] ? Fields[3] : "";
+    Alt = Fields[4] ? Fields[4] : "";
+    Format = Fields[8] ? Fields[8] : "";
+    Samples = Field;
+    ColumnsReady = false;
+    return true;
+}
+
+void VcfRecordReader::SetSampleRange(int StartSamId, int EndSamId)
+{
+    FirstSample = StartSamId;
+    LastSample = EndSamId;
+    ColumnsReady = false;
+}
+
+int VcfRecordReader::GetFormatIndex(const char *Key)
+{
+    size_t KeyLength = strlen(Key);
+    const char *Field = Format;
+    for(int Index=0; ; Index++)
+    {
+        const char *End = strchr(Field, ':');
+        size_t Length = End ? (size_t)(End-Field) : strlen(Field);
+        if(Length == KeyLength && strncmp(Field, Key, KeyLength) == 0)
+            return Index;
+        if(End == NULL)
+            return -1;
+        Field = End+1;
+    }
+}
+
+void VcfRecordReader::FindSampleColumns()
+{
+    SampleColumns.clear();
+    ColumnsReady = true;
+
+    const char *Column = Samples;
+    for(int Sample=0; Column != NULL && Sample < LastSample; Sample++)
+    {
+        if(Sample >= FirstSample)
+            SampleColumns.push_back(Column);
+        Column = (const char*)memchr(Column, '\t', LineEnd-Column);
+        if(Column != NULL)
+            Column++;
+    }
+}
+
+const char* VcfRecordReader::GetSampleField(int Sample, int Index)
+{
+    if(!ColumnsReady)
+        FindSampleColumns();
+    Sample -= FirstSample;
+    if(Index < 0 || Sample < 0 || Sample >= (int)SampleColumns.size())
+        return "";
+
+    const char *Field = SampleColumns[Sample];
+    for(int i=0; i<Index; i++)
+    {
+        while(*Field!=':' && *Field!='\t' && *Field!='\0')
+            Field++;
+        if(*Field != ':')
+            return "";
+        Field++;
+    }
+    return Field;
+}
+
+double VcfRecordReader::ParseFloat(const char *Text, const char **End)
+{
+    const char *c = Text;
+    bool Negative = (*c == '-');
+    if(*c == '-' || *c == '+')
+        c++;
+
+    // Mantissas of up to 15 digits and powers of 10 up to 1e15 are exact in
+    // double, so their quotient is correctly rounded, as strtod's result is.
+    unsigned long long Mantissa = 0;
+    int NoDigits = 0, NoDecimals = 0;
+    for(; *c>='0' && *c<='9'; c++, NoDigits++)
+        Mantissa = Mantissa*10 + (*c-'0');
+    if(*c == '.')
+        for(c++; *c>='0' && *c<='9'; c++, NoDigits++, NoDecimals++)
+            Mantissa = Mantissa*10 + (*c-'0');
+
+    if(NoDigits == 0 || NoDigits > MAX_EXACT_DIGITS || *c=='e' || *c=='E')
+    {
+        char *StrtodEnd;
+        double Value = strtod(Text, &StrtodEnd);
+        *End = StrtodEnd;
+        return Value;
+    }
+
+    double Value = Mantissa / PowersOf10[NoDecimals];
+    *End = c;
+    return Negative ? -Value : Value;
+}
@@ -0,0 +1,79 @@
+#ifndef METAM_VCFRECORDREADER_H
+#define METAM_VCFRECORDREADER_H
+
+#include "InputFile.h"
+#include "BgzfReader.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Reads the records of a dose or empiricalDose VCF in place, without
+// splitting them into per-sample strings.
+//
+// BGZF files are inflated in parallel by BgzfReader, and other files are
+// read through IFILE. Every record is kept as one line in a reusable
+// buffer. The site fields are terminated where they are, and the sample
+// columns are only located when a sample field is first asked for, with
+// one memchr per column. Only columns of the sample range are indexed:
+// earlier ones are skipped by their tabs and the scan stops after the last
+// one. A FORMAT key is looked up once per record and then addressed by its
+// index, and fields are parsed directly from the line with ParseFloat.
+
+class VcfRecordReader
+{
+public:
+
+    vector<string> SampleNames;
+
+    VcfRecordReader();
+    ~VcfRecordReader();
+
+    // Opens FileName and reads its header up to the #CHROM line. BGZF
+    // files are inflated on up to NoThreads threads.
+    bool Open(const char *FileName, int NoThreads);
+    void Close();
+    bool ReadRecord();
+
+    // Restricts sample fields to samples StartSamId..EndSamId-1.
+    void SetSampleRange(int StartSamId, int EndSamId);
+
+    const char* GetChromStr() { return Chrom; }
+    int Get1BasedPosition() { return Position; }
+    const char* GetRefStr() { return Ref; }
+    const char* GetAltStr() { return Alt; }
+
+    // Index of Key in the FORMAT of the current record, or -1.
+    int GetFormatIndex(const char *Key);
+
+    // Start of the field with FORMAT index Index of sample Sample in the
+    // current record, which ends at ':', '\t' or '\0'. Returns "" if the
+    // sample has fewer fields or is outside the sample range.
+    const char* GetSampleField(int Sample, int Index);
+
+    // Parses a number as atof does, setting End past it. Plain decimals of
+    // up to 15 digits, which is what the dose files hold, are converted
+    // with one exact division, and anything else is left to strtod.
+    static double ParseFloat(const char *Text, const char **End);
+
+private:
+
+    IFILE File;
+    BgzfReader Bgzf;
+    vector<char> Buffer;
+    size_t BufferStart, BufferEnd;
+    bool EndOfFile;
+
+    char *Line, *LineEnd;
+    const char *Chrom, *Ref, *Alt, *Format;
+    int Position;
+    char *Samples;
+    int FirstSample, LastSample;
+    vector<const char*> SampleColumns;
+    bool ColumnsReady;
+
+    bool ReadLine();
+    void FindSampleColumns();
+};
+
+#endif //METAM_VCFRECORDREADER_H
@@ -0,0 +1,96 @@
+#ifndef METAM_WEIGHTTENSOR_H
+#define METAM_WEIGHTTENSOR_H
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#define WEIGHT_ALIGNMENT 64
+
+// Flat store laid out as [site][study][haplotype], so the values of all
+// haplotypes of one study at one typed site are contiguous. Each row is
+// padded to a multiple of the alignment so that every row starts aligned.
+template<class T>
+class AlignedTensor
+{
+public:
+
+    int NoSites, NoStudies, NoHaps;
+    int HapStride;
+    T *Data;
+
+    AlignedTensor()
+    {
+        NoSites = NoStudies = NoHaps = HapStride = 0;
+        Data = NULL;
+        Capacity = 0;
+    };
+
+    // Tensors are never copied, only moved, so that classes holding them
+    // can still live in containers.
+    AlignedTensor(AlignedTensor &&Other) noexcept
+    {
+        NoSites = Other.NoSites;
+        NoStudies = Other.NoStudies;
+        NoHaps = Other.NoHaps;
+        HapStride = Other.HapStride;
+        Data = Other.Data;
+        Capacity = Other.Capacity;
+        Other.Data = NULL;
+        Other.Capacity = 0;
+    };
+
+    ~AlignedTensor()
+    {
+        free(Data);
+    };
+
+    // Memory is only reallocated when the tensor grows, so batches of the
+    // same size reuse one block. Contents are left uninitialized.
+    void Resize(int sites, int studies, int haps)
+    {
+        const int PerLine = WEIGHT_ALIGNMENT/sizeof(T);
+        NoSites = sites;
+        NoStudies = studies;
+        NoHaps = haps;
+        HapStride = (haps + PerLine - 1)/PerLine*PerLine;
+
+        size_t Required = (size_t)NoSites*NoStudies*HapStride;
+        if(Required > Capacity)
+        {
+            free(Data);
+            Data = NULL;
+            if(posix_memalign((void**)&Data, WEIGHT_ALIGNMENT, Required*sizeof(T)) != 0)
+                throw std::bad_alloc();
+            Capacity = Required;
+        }
+    };
+
+    void Fill(T value)
+    {
+        size_t Total = (size_t)NoSites*NoStudies*HapStride;
+        for(size_t i=0; i<Total; i++)
+            Data[i] = value;
+    };
+
+    T* Site(int site)
+    {
+        return Data + (size_t)site*NoStudies*HapStride;
+    };
+
+    T* Row(int site, int study)
+    {
+        return Data + ((size_t)site*NoStudies + study)*HapStride;
+    };
+
+private:
+
+    size_t Capacity;
+
+    AlignedTensor(const AlignedTensor&);
+    AlignedTensor& operator=(const AlignedTensor&);
+};
+
+typedef AlignedTensor<double> WeightTensor;
+
+#endif //METAM_WEIGHTTENSOR_H